@@ -0,0 +1,277 @@
+"""
+Footprint report and memory budgets of the firmware, a PlatformIO extra script.
+
+After every link the flash and SRAM use and the worst-case stack depth are checked against the
+budgets in platformio.ini, and the build fails if one is exceeded:
+
+  custom_flash_budget   bytes of flash for code and constant data
+  custom_ram_budget     bytes of SRAM for data, bss, the worst-case stack and the heap reserve
+  custom_stack_budget   bytes for the deepest call path of main plus one interrupt handler
+  custom_heap_reserve   bytes of SRAM kept free for the heap (String)
+
+`pio run -t footprint` prints the use per module and the deepest call paths.
+
+The use per module comes from the linker map, after unused sections were dropped. The stack
+depth comes from the disassembly of the ELF: every function costs its pushes, its frame and the
+return address of the call, along the deepest path from main, plus the deepest interrupt handler
+(handlers do not nest unless they enable interrupts, which is reported). Calls through pointers
+(task and command tables, virtual functions) are assumed to reach any function that is never
+called directly. Recursion is reported; the estimate then is a lower bound.
+
+Outside of PlatformIO: python scripts/footprint.py FIRMWARE.elf FIRMWARE.map [OBJDUMP]
+"""
+
+import os
+import re
+import subprocess
+import sys
+
+# Output sections of the linker map in flash and in SRAM
+FLASH_SECTIONS = (".text", ".data")
+RAM_SECTIONS = (".data", ".bss", ".noinit")
+
+# Runtime support that is entered before main or only jumps within a function
+STARTUP_FUNCTIONS = ("__vectors", "__ctors_end", "__init", "__do_copy_data", "__do_clear_bss",
+                     "__do_global_ctors", "__bad_interrupt", "_exit", "__stop_program")
+TABLE_JUMPS = ("__tablejump2__", "__tablejump__")
+
+
+def module_name(path):
+    """Names the module an input section of the map comes from."""
+    member = re.match(r"(.*?)([^/\\]+)\.a\((.+)\)$", path)
+    if member:
+        archive, name = member.group(2), member.group(3)
+        if archive in ("libgcc", "libc", "libm"):
+            return archive
+        return "%s/%s" % (archive.replace("libFramework", "").replace("lib", "", 1) or archive,
+                          re.sub(r"\.o$", "", name))
+    name = os.path.basename(path)
+    if name.startswith("crt"):
+        return "startup"
+    return re.sub(r"\.o$", "", name)
+
+
+def module_use(map_text):
+    """Returns {module: [flash, ram]} from a GNU ld map."""
+    modules = {}
+    start = map_text.find("Linker script and memory map")
+    lines = map_text[start:].splitlines() if start >= 0 else []
+
+    section = None
+    pending = None
+    for line in lines:
+        header = re.match(r"^(\.\S+)\s", line) or re.match(r"^(\.\S+)$", line)
+        if header:
+            section = header.group(1)
+            pending = None
+            continue
+        if section is None:
+            continue
+
+        single = re.match(r"^ (\.\S+)\s+0x[0-9a-fA-F]+\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+        wrapped = re.match(r"^\s+0x[0-9a-fA-F]+\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+        if single:
+            size, path = int(single.group(2), 16), single.group(3)
+        elif wrapped and pending:
+            size, path = int(wrapped.group(1), 16), wrapped.group(2)
+        else:
+            pending = re.match(r"^ (\.\S+)$", line)
+            continue
+        pending = None
+
+        use = modules.setdefault(module_name(path.strip()), [0, 0])
+        if section in FLASH_SECTIONS:
+            use[0] += size
+        if section in RAM_SECTIONS:
+            use[1] += size
+    return modules
+
+
+def parse_functions(disassembly, pc_bytes):
+    """Returns {name: function} with the frame size and the calls of every function."""
+    functions = {}
+    name = None
+    current = None
+    in_prologue = False
+    for line in disassembly.splitlines():
+        header = re.match(r"^([0-9a-f]+) <(.+)>:$", line)
+        if header:
+            name = header.group(2)
+            current = {"frame": 0, "calls": [], "indirect": False, "sei": False}
+            functions[name] = current
+            in_prologue = True
+            continue
+        instruction = re.match(r"^\s+[0-9a-f]+:\t[0-9a-f ]+\t(\S+)\s*([^;]*)(?:;.*<([^>+]+)(?:\+0x[0-9a-f]+)?>)?",
+                               line)
+        if not current or not instruction:
+            continue
+        mnemonic, operands, target = instruction.group(1), instruction.group(2).strip(), instruction.group(3)
+
+        if mnemonic == "push":
+            current["frame"] += 1
+        elif mnemonic == "rcall" and operands.startswith(".+0"):
+            # allocates a small frame by pushing a return address
+            current["frame"] += pc_bytes
+        elif in_prologue and mnemonic == "sbiw" and operands.startswith("r28"):
+            current["frame"] += int(operands.split(",")[1], 0)
+        elif in_prologue and mnemonic == "subi" and operands.startswith("r28"):
+            current["frame"] += int(operands.split(",")[1], 0) & 0xFF
+        elif in_prologue and mnemonic == "sbci" and operands.startswith("r29"):
+            current["frame"] += (int(operands.split(",")[1], 0) & 0xFF) << 8
+        elif mnemonic == "out" and operands.startswith("0x3d"):
+            in_prologue = False
+        elif mnemonic in ("call", "rcall") and target and target != name:
+            current["calls"].append((target, pc_bytes))
+        elif mnemonic in ("jmp", "rjmp") and target and target != name:
+            current["calls"].append((target, 0))
+        elif mnemonic in ("icall", "eicall", "ijmp", "eijmp") and name not in TABLE_JUMPS:
+            current["indirect"] = True
+        elif mnemonic == "sei":
+            current["sei"] = True
+    return functions
+
+
+def stack_depths(functions, pc_bytes):
+    """Returns the deepest path from main and from the interrupt handlers, and the recursions."""
+    called = set(target for function in functions.values() for target, _ in function["calls"])
+    indirect_targets = [name for name in functions
+                        if name not in called and name != "main" and not name.startswith("__vector")
+                        and name not in STARTUP_FUNCTIONS and name not in TABLE_JUMPS]
+    depths = {}
+    recursions = set()
+
+    def depth(name, path):
+        if name in depths:
+            return depths[name]
+        function = functions.get(name)
+        if function is None:
+            return (0, [name])
+        best = (0, [])
+        edges = list(function["calls"])
+        if function["indirect"]:
+            edges += [(target, pc_bytes) for target in indirect_targets]
+        for target, cost in edges:
+            if target in path:
+                recursions.add(" > ".join(path[path.index(target):] + [target]))
+                continue
+            bytes_below, below = depth(target, path + [target])
+            if cost + bytes_below > best[0]:
+                best = (cost + bytes_below, below)
+        depths[name] = (function["frame"] + best[0], [name] + best[1])
+        return depths[name]
+
+    main = depth("main", ["main"]) if "main" in functions else (0, [])
+    handler = (0, [])
+    nesting = []
+    for name in functions:
+        if name.startswith("__vector") and name != "__vectors":
+            # the interrupt pushes the return address before the handler runs
+            bytes_used, path = depth(name, [name])
+            if bytes_used + pc_bytes > handler[0]:
+                handler = (bytes_used + pc_bytes, path)
+            if functions[name]["sei"]:
+                nesting.append(name)
+    return main, handler, sorted(recursions), nesting
+
+
+class Budgets:
+    def __init__(self, flash, ram, stack, heap, flash_size, ram_size):
+        self.flash = flash
+        self.ram = ram
+        self.stack = stack
+        self.heap = heap
+        self.flash_size = flash_size
+        self.ram_size = ram_size
+
+
+def footprint(elf, map_path, objdump, pc_bytes, budgets, detailed):
+    """Prints the footprint and returns the list of exceeded budgets."""
+    with open(map_path) as map_file:
+        modules = module_use(map_file.read())
+    disassembly = subprocess.run([objdump, "-d", elf], check=True, stdout=subprocess.PIPE,
+                                 universal_newlines=True).stdout
+    functions = parse_functions(disassembly, pc_bytes)
+    main, handler, recursions, nesting = stack_depths(functions, pc_bytes)
+
+    flash = sum(use[0] for use in modules.values())
+    ram = sum(use[1] for use in modules.values())
+    stack = main[0] + handler[0]
+    total = ram + stack + budgets.heap
+
+    if detailed:
+        print("%-32s %8s %8s" % ("module", "flash", "ram"))
+        for name, use in sorted(modules.items(), key=lambda item: (-item[1][1], -item[1][0])):
+            print("%-32s %8d %8d" % (name, use[0], use[1]))
+        print("%-32s %8d %8d" % ("total", flash, ram))
+        print()
+        print("deepest path from main (%d bytes): %s" % (main[0], " > ".join(main[1])))
+        print("deepest interrupt (%d bytes): %s" % (handler[0], " > ".join(handler[1])))
+        print()
+
+    print("Flash: %d of %d bytes (budget %d)" % (flash, budgets.flash_size, budgets.flash))
+    print("RAM:   %d static + %d stack + %d heap = %d of %d bytes (budget %d), %d bytes headroom" %
+          (ram, stack, budgets.heap, total, budgets.ram_size, budgets.ram, budgets.ram - total))
+    print("Stack: %d bytes worst case = %d main + %d interrupt (budget %d)" %
+          (stack, main[0], handler[0], budgets.stack))
+    for recursion in recursions:
+        print("Warning: recursion %s, the stack estimate is a lower bound" % recursion)
+    for name in nesting:
+        print("Warning: %s enables interrupts, handlers may nest" % name)
+
+    exceeded = []
+    if flash > budgets.flash:
+        exceeded.append("flash %d > %d" % (flash, budgets.flash))
+    if total > budgets.ram:
+        exceeded.append("RAM %d > %d" % (total, budgets.ram))
+    if stack > budgets.stack:
+        exceeded.append("stack %d > %d" % (stack, budgets.stack))
+    return exceeded
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        sys.exit("usage: footprint.py FIRMWARE.elf FIRMWARE.map [OBJDUMP]")
+    limits = Budgets(flash=253952, ram=8192, stack=8192, heap=0, flash_size=253952, ram_size=8192)
+    failed = footprint(sys.argv[1], sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else "avr-objdump", 3, limits,
+                       True)
+    sys.exit(1 if failed else 0)
+
+Import("env")  # noqa: F821, provided by PlatformIO
+
+MAP = "$BUILD_DIR/${PROGNAME}.map"
+ELF = "$BUILD_DIR/${PROGNAME}.elf"
+
+env.Append(LINKFLAGS=["-Wl,-Map," + MAP])  # noqa: F821
+
+
+def budgets_of(env):
+    board = env.BoardConfig()
+    flash_size = int(board.get("upload.maximum_size"))
+    ram_size = int(board.get("upload.maximum_ram_size"))
+
+    def option(name, default):
+        return int(env.GetProjectOption(name, default))
+
+    return Budgets(flash=option("custom_flash_budget", flash_size), ram=option("custom_ram_budget", ram_size),
+                   stack=option("custom_stack_budget", ram_size), heap=option("custom_heap_reserve", 0),
+                   flash_size=flash_size, ram_size=ram_size)
+
+
+def run(env, detailed):
+    # devices with more than 128 KB of flash push 3-byte return addresses
+    pc_bytes = 3 if int(env.BoardConfig().get("upload.maximum_size")) > 131072 else 2
+    objdump = env.subst("$CC").replace("gcc", "objdump")
+    exceeded = footprint(env.subst(ELF), env.subst(MAP), objdump, pc_bytes, budgets_of(env), detailed)
+    if exceeded:
+        sys.stderr.write("Footprint budget exceeded: %s\n" % ", ".join(exceeded))
+        env.Exit(1)
+
+
+env.AddPostAction(ELF, env.VerboseAction(lambda target, source, env: run(env, False),  # noqa: F821
+                                          "Checking footprint budgets"))
+env.AddCustomTarget(  # noqa: F821
+    name="footprint",
+    dependencies=ELF,
+    actions=[lambda target, source, env: run(env, True)],
+    title="Footprint",
+    description="Flash and RAM per module, worst-case stack and budgets")
@@ -0,0 +1,27 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <Arduino.h>
+
+// Hardware hooks of the measurement, implemented by the firmware and by the host rig
+
+/**
+ * @brief Opens or closes the valve.
+ *
+ * @param open True to open the valve.
+ *
+ * @return void
+ */
+void setValve(bool open);
+
+/**
+ * @brief Writes a given string to a specified line of the LCD display.
+ *
+ * @param string_to_write The string to be written to the LCD display.
+ * @param line The line number on the LCD display (0-indexed). Default value is 0.
+ *
+ * @return void
+ */
+void writeToDisplay(const String string_to_write, const int line = 0);
+
+#endif
@@ -0,0 +1,113 @@
+#include "clock.h"
+
+#ifdef ARDUINO
+
+#include <avr/interrupt.h>
+
+#if F_CPU != 16000000L
+#error "clock.cpp assumes a 16 MHz system clock (two timer ticks per microsecond)"
+#endif
+
+// Upper bits of the tick counter, incremented every 65536 ticks (32.768 ms)
+static volatile uint64_t clockOverflows = 0;
+
+ISR(TIMER5_OVF_vect)
+{
+  clockOverflows++;
+}
+
+void clockBegin()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  TCCR5A = 0;
+  TCCR5B = 0;
+  TCNT5 = 0;
+  clockOverflows = 0;
+  TIFR5 = _BV(TOV5);
+  TIMSK5 = _BV(TOIE5);
+  // start the timer with prescaler 8
+  TCCR5B = _BV(CS51);
+
+  SREG = oldSREG;
+}
+
+uint64_t clockMicros()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  uint16_t ticks = TCNT5;
+  uint64_t overflows = clockOverflows;
+
+  // the counter wrapped but the overflow interrupt has not run yet
+  if ((TIFR5 & _BV(TOV5)) && ticks < 0x8000)
+  {
+    overflows++;
+  }
+
+  SREG = oldSREG;
+
+  return ((overflows << 16) | ticks) >> 1;
+}
+
+uint32_t clockTicks()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  uint16_t ticks = TCNT5;
+  uint16_t overflows = (uint16_t)clockOverflows;
+
+  if ((TIFR5 & _BV(TOV5)) && ticks < 0x8000)
+  {
+    overflows++;
+  }
+
+  SREG = oldSREG;
+
+  return ((uint32_t)overflows << 16) | ticks;
+}
+
+#else
+
+// Virtual time of the native build, set by the host program
+static uint64_t clockNow = 0;
+
+void clockBegin()
+{
+  clockNow = 0;
+}
+
+uint64_t clockMicros()
+{
+  return clockNow;
+}
+
+uint32_t clockTicks()
+{
+  return (uint32_t)(clockNow * 2);
+}
+
+void clockSetMicros(uint64_t micros)
+{
+  clockNow = micros;
+}
+
+#endif
+
+String microsToString(uint64_t micros)
+{
+  char buffer[21];
+  char *digit = &buffer[sizeof(buffer) - 1];
+  *digit = '\0';
+
+  do
+  {
+    *--digit = '0' + (micros % 10);
+    micros /= 10;
+  } while (micros > 0);
+
+  return String(digit);
+}
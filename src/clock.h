@@ -0,0 +1,62 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * @brief Starts the monotonic microsecond clock.
+ *
+ * Timer5 runs free with a prescaler of 8 (0.5 us per tick at 16 MHz) and its overflow interrupt
+ * extends the 16-bit counter to 64 bits. Unlike millis(), the clock never wraps during the
+ * lifetime of the board and has sub-microsecond resolution.
+ *
+ * @return void
+ */
+void clockBegin();
+
+/**
+ * @brief Returns the microseconds elapsed since clockBegin() was called.
+ *
+ * Safe to call from interrupt handlers and with interrupts disabled.
+ *
+ * @return uint64_t The monotonic time in microseconds.
+ */
+uint64_t clockMicros();
+
+/**
+ * @brief Returns the low 32 bits of the Timer5 tick counter, 0.5 us per tick.
+ *
+ * Cheaper than clockMicros() for interval measurements in interrupt handlers; differences of two
+ * values are correct for intervals up to 35 minutes.
+ *
+ * @return uint32_t The tick counter.
+ */
+uint32_t clockTicks();
+
+#ifndef ARDUINO
+/**
+ * @brief Sets the virtual time of the native build.
+ *
+ * On the host the clock does not run by itself; the simulation moves it forward.
+ *
+ * @param micros The new time in microseconds, never less than the current time.
+ *
+ * @return void
+ */
+void clockSetMicros(uint64_t micros);
+#endif
+
+/**
+ * @brief Formats a 64-bit microsecond value as a decimal string.
+ *
+ * The Arduino String class has no constructor for 64-bit integers, so timestamps pass through
+ * this helper before they are logged.
+ *
+ * @param micros The value to format.
+ *
+ * @return String The decimal representation of the value.
+ */
+String microsToString(uint64_t micros);
+
+#endif
@@ -0,0 +1,116 @@
+#include "commands.h"
+
+#include "clock.h"
+#include "log.h"
+
+// Longest accepted command line
+const uint8_t commandLineSize = 48;
+
+static char commandLine[commandLineSize];
+static uint8_t commandLength = 0;
+static bool commandReady = false; // commandLine is complete and waits for commandsPoll()
+static uint64_t commandMicros = 0;
+
+/**
+ * Looks up the command of a line, or returns 0. args receives the rest of the line.
+ */
+static const Command *commandsFind(const char *line, const char *&args)
+{
+  for (uint8_t i = 0; i < commandCount; i++)
+  {
+    size_t length = strlen(commands[i].name);
+    if (strncmp(line, commands[i].name, length) == 0 && (line[length] == ' ' || line[length] == '\0'))
+    {
+      args = line + length;
+      while (*args == ' ')
+      {
+        args++;
+      }
+      return &commands[i];
+    }
+  }
+  return 0;
+}
+
+/**
+ * Runs the command of the complete line and empties the line.
+ */
+static void commandsRun()
+{
+  const char *args;
+  const Command *command = commandsFind(commandLine, args);
+  if (command)
+  {
+    command->run(args);
+  }
+  else
+  {
+    logLine("Unknown command: " + String(commandLine));
+  }
+  commandReady = false;
+  commandLength = 0;
+}
+
+void commandsReceive()
+{
+  while (!commandReady && Serial.available() > 0)
+  {
+    char c = Serial.read();
+
+    if (c == '\r' || c == '\n')
+    {
+      if (commandLength > 0)
+      {
+        commandLine[commandLength] = '\0';
+        commandMicros = clockMicros();
+        commandReady = true;
+
+        const char *args;
+        const Command *command = commandsFind(commandLine, args);
+        if (command && command->immediate)
+        {
+          commandsRun();
+        }
+      }
+    }
+    else if (commandLength < commandLineSize - 1)
+    {
+      commandLine[commandLength++] = c;
+    }
+  }
+}
+
+void commandsPoll()
+{
+  commandsReceive();
+  while (commandReady)
+  {
+    commandsRun();
+    commandsReceive();
+  }
+}
+
+uint64_t commandsReceivedMicros()
+{
+  return commandMicros;
+}
+
+bool parseNumbers(const char *args, unsigned long *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    char *end;
+    values[i] = strtoul(args, &end, 10);
+    if (end == args)
+    {
+      return false;
+    }
+    args = end;
+  }
+
+  while (*args == ' ')
+  {
+    args++;
+  }
+  return *args == '\0';
+}
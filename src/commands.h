@@ -0,0 +1,63 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * A command accepted on the serial monitor.
+ *
+ * A line starting with the name calls run() with the rest of the line, without leading spaces.
+ * An immediate command runs as soon as its line is received, from commandsReceive(); the others
+ * run from commandsPoll().
+ */
+struct Command
+{
+  const char *name;
+  void (*run)(const char *args);
+  bool immediate = false;
+};
+
+// The command table is defined by the application at compile time
+extern const Command commands[];
+extern const uint8_t commandCount;
+
+/**
+ * @brief Reads received characters until a line is complete and notes the time of its line ending.
+ *
+ * An immediate command runs right away; any other line waits for commandsPoll(), and no further
+ * characters are read until then. Called on every pass of the main loop, so the time is within a
+ * loop pass of the arrival of the line ending.
+ *
+ * @return void
+ */
+void commandsReceive();
+
+/**
+ * @brief Reads received characters and runs the command of every completed line.
+ *
+ * Unknown commands are answered with "Unknown command: <line>".
+ *
+ * @return void
+ */
+void commandsPoll();
+
+/**
+ * @brief Returns the clock when the line ending of the command being run was received.
+ *
+ * @return uint64_t The time in microseconds.
+ */
+uint64_t commandsReceivedMicros();
+
+/**
+ * @brief Parses the arguments of a command as unsigned numbers separated by spaces.
+ *
+ * @param args The arguments passed to run().
+ * @param values Receives the numbers.
+ * @param count The number of numbers expected.
+ *
+ * @return bool True if the arguments are exactly count numbers.
+ */
+bool parseNumbers(const char *args, unsigned long *values, uint8_t count);
+
+#endif
@@ -0,0 +1,66 @@
+#include "console.h"
+
+#include "clock.h"
+#include "commands.h"
+#include "histogram.h"
+#include "log.h"
+#include "measurement.h"
+#include "selftest.h"
+#include "stream.h"
+#include "trace.h"
+
+void traceCommand(const char *args)
+{
+  if (strcmp(args, "on") == 0 || strcmp(args, "stream") == 0)
+  {
+    traceEnable(true);
+    streamEnable(strcmp(args, "stream") == 0);
+  }
+  else if (strcmp(args, "off") == 0)
+  {
+    streamEnable(false);
+    traceEnable(false);
+  }
+  else
+  {
+    logLine("Usage: trace on|off|stream");
+  }
+}
+
+void jobCommand(const char *args)
+{
+  unsigned long values[2];
+  if (!parseNumbers(args, values, 2))
+  {
+    logLine("Usage: job <seconds> <cycles>");
+    return;
+  }
+  runMessurementJob(values[0], values[1]);
+}
+
+void selfTestCommand(const char *args)
+{
+  unsigned long seconds = 1;
+  if (*args != '\0' && !parseNumbers(args, &seconds, 1))
+  {
+    logLine("Usage: selftest [seconds]");
+    return;
+  }
+  startSelfTest(seconds);
+}
+
+void histCommand(const char *)
+{
+  histogramReport();
+}
+
+void syncCommand(const char *args)
+{
+  unsigned long token;
+  if (!parseNumbers(args, &token, 1))
+  {
+    logLine("Usage: sync <token>");
+    return;
+  }
+  logLineFirst("Sync: " + String(token) + " " + microsToString(commandsReceivedMicros()));
+}
@@ -0,0 +1,62 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <Arduino.h>
+
+// Serial commands shared by the firmware and the simulated board; each application lists them in
+// its own command table
+
+/**
+ * @brief Command "trace on|off|stream": starts or stops sending pulse, valve, button and start events.
+ *
+ * With "stream" the pulses are sent in compressed binary frames instead of trace lines.
+ *
+ * @param args "on", "off" or "stream".
+ *
+ * @return void
+ */
+void traceCommand(const char *args);
+
+/**
+ * @brief Command "job <seconds> <cycles>": starts a measurement with the given profile, e.g. one
+ * planned on the host.
+ *
+ * @param args The seconds per cycle and the number of cycles.
+ *
+ * @return void
+ */
+void jobCommand(const char *args);
+
+/**
+ * @brief Command "selftest [seconds]": checks the pulse input with generated pulses of rising rate,
+ * looped back from pin 6 to pin 2.
+ *
+ * @param args The gate time per rate in seconds, 1 if empty.
+ *
+ * @return void
+ */
+void selfTestCommand(const char *args);
+
+/**
+ * @brief Command "hist": sends the pulse interval histogram of the last measurement again.
+ *
+ * @param args Unused.
+ *
+ * @return void
+ */
+void histCommand(const char *args);
+
+/**
+ * @brief Command "sync <token>": answers a clock sync request of the host with
+ * "Sync: <token> <micros>", the clock when the line ending of the request was received.
+ *
+ * An immediate command: the answer goes out ahead of the queued log output, so the round trip the
+ * host measures is not stretched by the command task or the log queue.
+ *
+ * @param args The token of the request, echoed so the host can pair request and answer.
+ *
+ * @return void
+ */
+void syncCommand(const char *args);
+
+#endif
@@ -0,0 +1,179 @@
+#include "estop.h"
+
+#include "board.h"
+#include "clock.h"
+#include "log.h"
+#include "measurement.h"
+
+// Defines for Emergency stop
+const unsigned long estopReleaseMicros = 100000;
+
+static volatile bool estopActive = false;
+static volatile bool estopPending = false;
+static volatile unsigned long estopPulses;
+static volatile bool estopCaptured;
+static volatile uint16_t estopLatencyTicks;
+static uint16_t estopMaxLatencyTicks = 0;
+static uint64_t estopReleasedSince = 0;
+
+#ifdef ARDUINO
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+// Defines for Pins
+const int estopPin = 3;         // INT5
+const int estopCapturePin = 48; // ICP5, same button
+
+ISR(INT5_vect)
+{
+  // the valve on pin 22 is PA0: one sbi closes it before anything else
+  PORTA |= _BV(PA0);
+  uint16_t closed = TCNT5;
+
+  estopPulses = pulses;
+  EIMSK &= ~_BV(INT5);
+
+  // Timer5 captured the falling edge of the button on ICP5, in the same 0.5 us ticks
+  estopCaptured = TIFR5 & _BV(ICF5);
+  estopLatencyTicks = closed - ICR5;
+
+  estopActive = true;
+  estopPending = true;
+}
+
+/**
+ * @brief Tells whether the button is pressed right now.
+ *
+ * @return bool True while the input is low.
+ */
+static bool estopPressed()
+{
+  return digitalRead(estopPin) == LOW;
+}
+
+/**
+ * @brief Arms the interrupt for the next press, dropping edges seen while disarmed.
+ *
+ * @return void
+ */
+static void estopArm()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  TIFR5 = _BV(ICF5);
+  EIFR = _BV(INTF5);
+  EIMSK |= _BV(INT5);
+
+  SREG = oldSREG;
+}
+
+void estopBegin()
+{
+  pinMode(estopPin, INPUT_PULLUP);
+  pinMode(estopCapturePin, INPUT_PULLUP);
+
+  // falling edge on INT5; ICP5 captures falling edges with the clock settings of Timer5
+  EICRB = (EICRB & ~(_BV(ISC50) | _BV(ISC51))) | _BV(ISC51);
+
+  if (estopPressed())
+  {
+    estopActive = true;
+    abortMeasurement(0);
+    logLine("Emergency stop: engaged at boot");
+    return;
+  }
+  estopArm();
+}
+
+#else
+
+// The native build has no button: a press comes from estopPress() and is released right away
+static bool estopPressed()
+{
+  return false;
+}
+
+static void estopArm()
+{
+}
+
+void estopBegin()
+{
+}
+
+void estopPress()
+{
+  if (estopActive)
+  {
+    return;
+  }
+  setValve(false);
+  estopPulses = pulses;
+  estopCaptured = false;
+  estopActive = true;
+  estopPending = true;
+}
+
+#endif
+
+bool estopEngaged()
+{
+  return estopActive;
+}
+
+void estopPoll()
+{
+  if (!estopActive)
+  {
+    return;
+  }
+
+  if (estopPending)
+  {
+    noInterrupts();
+    unsigned long count = estopPulses;
+    bool captured = estopCaptured;
+    uint16_t ticks = estopLatencyTicks;
+    estopPending = false;
+    interrupts();
+
+    abortMeasurement(count);
+
+    if (captured)
+    {
+      if (ticks > estopMaxLatencyTicks)
+      {
+        estopMaxLatencyTicks = ticks;
+      }
+      logLine("Emergency stop: " + String(ticks / 2.0, 1) + "us (max " + String(estopMaxLatencyTicks / 2.0, 1) + "us)");
+    }
+    else
+    {
+      logLine("Emergency stop: latency not measured (no capture on pin 48)");
+    }
+    estopReleasedSince = 0;
+  }
+
+  // rearm once the button has stayed released, which also debounces it
+  uint64_t now = clockMicros();
+  if (estopPressed())
+  {
+    estopReleasedSince = 0;
+    return;
+  }
+  if (estopReleasedSince == 0)
+  {
+    estopReleasedSince = now;
+  }
+  if (now - estopReleasedSince < estopReleaseMicros)
+  {
+    return;
+  }
+
+  estopActive = false;
+  releaseMeasurement();
+  estopArm();
+  logLine("Emergency stop: released");
+}
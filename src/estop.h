@@ -0,0 +1,48 @@
+#ifndef ESTOP_H
+#define ESTOP_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * @brief Arms the emergency stop on pin 3 (INT5, falling edge).
+ *
+ * The interrupt handler closes the valve with a single port write, freezes the pulse count of the
+ * run and disarms itself; estopPoll() then aborts the run and logs the latency. If the button is
+ * also wired to pin 48 (ICP5), Timer5 captures the time of the press in hardware and the latency
+ * from the press to the closed valve is measured.
+ *
+ * A button held at boot engages the stop right away.
+ *
+ * @return void
+ */
+void estopBegin();
+
+/**
+ * @brief Tells whether the emergency stop is engaged. The valve must not open while it is.
+ *
+ * @return bool True from the press until the button has been released for a while.
+ */
+bool estopEngaged();
+
+/**
+ * @brief Aborts the run after a press and rearms the stop once the button is released.
+ *
+ * Logs "Emergency stop: <latency>us (max <latency>us)" for every press.
+ *
+ * @return void
+ */
+void estopPoll();
+
+#ifndef ARDUINO
+/**
+ * @brief Presses the emergency stop of the native build, like the interrupt handler would.
+ *
+ * The button is released right away.
+ *
+ * @return void
+ */
+void estopPress();
+#endif
+
+#endif
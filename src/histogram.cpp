@@ -0,0 +1,188 @@
+#include "histogram.h"
+
+#include <util/atomic.h>
+
+#include "clock.h"
+#include "log.h"
+
+const uint8_t histogramSubMask = (1 << histogramSubBits) - 1;
+
+// Space a bin line takes in the log, including the line ending
+const unsigned int histogramLineLength = 32;
+
+static volatile uint32_t histogramCounts[histogramBins];
+static volatile bool histogramRecording = false;
+static bool histogramStarted = false;
+static uint32_t histogramPrevious = 0;
+static uint8_t histogramNextBin = histogramBins;
+
+/**
+ * @brief Finds the bin of an interval.
+ *
+ * @param ticks The interval in timer ticks.
+ *
+ * @return uint8_t The bin.
+ */
+static uint8_t histogramBin(uint32_t ticks)
+{
+  if (ticks < ((uint32_t)1 << histogramMinShift))
+  {
+    return 0;
+  }
+  uint8_t msb = sizeof(unsigned long) * 8 - 1 - __builtin_clzl(ticks);
+  if (msb >= histogramMaxShift)
+  {
+    return histogramBins - 1;
+  }
+  return 1 + ((msb - histogramMinShift) << histogramSubBits) + ((ticks >> (msb - histogramSubBits)) & histogramSubMask);
+}
+
+/**
+ * @brief Returns the shortest interval of a bin.
+ *
+ * @param bin The bin.
+ *
+ * @return uint32_t The interval in timer ticks.
+ */
+static uint32_t histogramLower(uint8_t bin)
+{
+  if (bin == 0)
+  {
+    return 0;
+  }
+  if (bin == histogramBins - 1)
+  {
+    return (uint32_t)1 << histogramMaxShift;
+  }
+  uint8_t octave = (bin - 1) >> histogramSubBits;
+  uint8_t sub = (bin - 1) & histogramSubMask;
+  return (uint32_t)((1 << histogramSubBits) + sub) << (octave + histogramMinShift - histogramSubBits);
+}
+
+/**
+ * @brief Returns the middle of a bin; the open bin above is represented by its lower end.
+ *
+ * @param bin The bin.
+ *
+ * @return uint32_t The interval in timer ticks.
+ */
+static uint32_t histogramMiddle(uint8_t bin)
+{
+  if (bin == histogramBins - 1)
+  {
+    return histogramLower(bin);
+  }
+  return (histogramLower(bin) + histogramLower(bin + 1)) / 2;
+}
+
+/**
+ * @brief Reads a bin consistently while the pulse interrupt may update it.
+ *
+ * @param bin The bin.
+ *
+ * @return uint32_t The number of intervals in the bin.
+ */
+static uint32_t histogramCount(uint8_t bin)
+{
+  uint32_t count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    count = histogramCounts[bin];
+  }
+  return count;
+}
+
+/**
+ * @brief Finds the interval below which a share of all intervals lie.
+ *
+ * @param total The number of intervals.
+ * @param percent The share in percent.
+ *
+ * @return uint32_t The middle of the bin of the percentile, in timer ticks.
+ */
+static uint32_t histogramPercentile(uint32_t total, uint8_t percent)
+{
+  uint32_t rank = (uint32_t)(((uint64_t)total * percent + 99) / 100);
+  uint32_t seen = 0;
+  for (uint8_t bin = 0; bin < histogramBins; bin++)
+  {
+    seen += histogramCount(bin);
+    if (seen >= rank && seen > 0)
+    {
+      return histogramMiddle(bin);
+    }
+  }
+  return 0;
+}
+
+void histogramReset()
+{
+  histogramRecording = false;
+  histogramNextBin = histogramBins;
+  for (uint8_t bin = 0; bin < histogramBins; bin++)
+  {
+    histogramCounts[bin] = 0;
+  }
+}
+
+void histogramEnable(bool enable)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    histogramStarted = false;
+    histogramRecording = enable;
+  }
+}
+
+void histogramPulse()
+{
+  if (!histogramRecording)
+  {
+    return;
+  }
+
+  uint32_t now = clockTicks();
+  if (histogramStarted)
+  {
+    histogramCounts[histogramBin(now - histogramPrevious)]++;
+  }
+  histogramPrevious = now;
+  histogramStarted = true;
+}
+
+void histogramReport()
+{
+  uint32_t total = 0;
+  for (uint8_t bin = 0; bin < histogramBins; bin++)
+  {
+    total += histogramCount(bin);
+  }
+  if (total == 0)
+  {
+    logLine("Intervals: 0");
+    return;
+  }
+
+  uint32_t p10 = histogramPercentile(total, 10);
+  uint32_t p50 = histogramPercentile(total, 50);
+  uint32_t p90 = histogramPercentile(total, 90);
+  float spread = (p90 - p10) * 100.0f / p50;
+
+  // timer ticks are half microseconds
+  logLine("Intervals: " + String(total) + " p10 " + String(p10 / 2) + "us p50 " + String(p50 / 2) + "us p90 " +
+          String(p90 / 2) + "us spread " + String(spread, 1) + "%");
+  histogramNextBin = 0;
+}
+
+void histogramFlush()
+{
+  while (histogramNextBin < histogramBins && logSpace() >= histogramLineLength)
+  {
+    uint8_t bin = histogramNextBin++;
+    uint32_t count = histogramCount(bin);
+    if (count > 0)
+    {
+      logLine("Interval " + String(histogramLower(bin) / 2) + "us: " + String(count));
+    }
+  }
+}
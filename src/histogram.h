@@ -0,0 +1,61 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Defines for Histogram: 4 bins per octave from 16 us to 8.4 s, one bin below and one above
+const uint8_t histogramSubBits = 2;
+const uint8_t histogramMinShift = 5;  // 32 ticks = 16 us
+const uint8_t histogramMaxShift = 24; // 2^24 ticks = 8.4 s
+const uint8_t histogramBins = 2 + (histogramMaxShift - histogramMinShift) * (1 << histogramSubBits);
+
+/**
+ * @brief Clears the histogram and stops recording, e.g. at the start of a measurement.
+ *
+ * @return void
+ */
+void histogramReset();
+
+/**
+ * @brief Starts or stops recording pulse intervals, e.g. while the valve is open.
+ *
+ * The first pulse after the start only sets the reference; its interval to the last pulse before
+ * the stop is not recorded.
+ *
+ * @param enable True to start recording.
+ *
+ * @return void
+ */
+void histogramEnable(bool enable);
+
+/**
+ * @brief Records the interval since the previous pulse. Called by the pulse interrupt.
+ *
+ * Takes constant time: the bin is found from the highest set bit of the interval and the two bits
+ * below it, so each bin is about 19% wide at any interval. Does nothing while not recording, so
+ * the self-test pulses are not slowed down.
+ *
+ * @return void
+ */
+void histogramPulse();
+
+/**
+ * @brief Starts sending the histogram.
+ *
+ * Logs "Intervals: <n> p10 <us>us p50 <us>us p90 <us>us spread <percent>%", the percentiles at
+ * the resolution of the bins and the spread (p90 - p10) / p50. The non-empty bins follow as
+ * "Interval <lower>us: <count>", sent by histogramFlush().
+ *
+ * @return void
+ */
+void histogramReport();
+
+/**
+ * @brief Sends pending bins of the histogram while the log has room for them.
+ *
+ * @return void
+ */
+void histogramFlush();
+
+#endif
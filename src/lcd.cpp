@@ -0,0 +1,146 @@
+#include "lcd.h"
+
+#include "clock.h"
+#include "twi.h"
+
+// PCF8574 port bits wired to the display
+const uint8_t lcdRegisterSelect = 0x01;
+const uint8_t lcdEnable = 0x04;
+const uint8_t lcdBacklight = 0x08;
+
+// HD44780 commands
+const uint8_t lcdSetDdramAddress = 0x80;
+const uint8_t lcdSecondLineAddress = 0x40;
+
+/**
+ * One step of the power-on initialization: a single nibble in 8-bit mode or a full command in
+ * 4-bit mode, followed by the time the controller needs to execute it.
+ */
+struct LcdInitStep
+{
+  uint8_t value;
+  bool nibble;
+  uint16_t delay;
+};
+
+// Initialization by instruction, see the HD44780 datasheet figure 24
+const LcdInitStep lcdInitSteps[] = {
+    {0x03, true, 4500},
+    {0x03, true, 4500},
+    {0x03, true, 150},
+    {0x02, true, 150},
+    {0x28, false, 100}, // 4-bit interface, 2 lines, 5x8 font
+    {0x0C, false, 100}, // display on, no cursor
+    {0x01, false, 2000}, // clear
+    {0x06, false, 100}, // entry mode: increment, no shift
+};
+const uint8_t lcdInitStepCount = sizeof(lcdInitSteps) / sizeof(lcdInitSteps[0]);
+
+// Time the display needs after power-on before it accepts instructions
+const uint32_t lcdPowerOnDelay = 50000;
+
+static uint8_t lcdAddress = 0;
+static uint8_t lcdInitStep = 0;
+static uint64_t lcdNextStepTime = 0;
+
+static char lcdFrame[lcdRows][lcdColumns];
+static bool lcdDirty[lcdRows];
+
+/**
+ * Encodes a nibble as three expander writes: data with RS set up, enable high, enable low.
+ */
+static uint8_t lcdEncodeNibble(uint8_t *out, uint8_t nibble, uint8_t mode)
+{
+  uint8_t value = (nibble << 4) | mode | lcdBacklight;
+  out[0] = value;
+  out[1] = value | lcdEnable;
+  out[2] = value;
+  return 3;
+}
+
+static uint8_t lcdEncodeByte(uint8_t *out, uint8_t value, uint8_t mode)
+{
+  uint8_t length = lcdEncodeNibble(out, value >> 4, mode);
+  return length + lcdEncodeNibble(out + length, value & 0x0F, mode);
+}
+
+void lcdBegin(uint8_t address)
+{
+  lcdAddress = address;
+  lcdInitStep = 0;
+  lcdNextStepTime = clockMicros() + lcdPowerOnDelay;
+
+  twiBegin(400000);
+}
+
+void lcdSetLine(uint8_t line, const char *text)
+{
+  bool end = false;
+
+  for (int i = 0; i < lcdColumns; i++)
+  {
+    end = end || text[i] == '\0';
+    char c = end ? ' ' : text[i];
+
+    if (lcdFrame[line][i] != c)
+    {
+      lcdFrame[line][i] = c;
+      lcdDirty[line] = true;
+    }
+  }
+}
+
+void lcdPoll()
+{
+  twiPoll();
+
+  uint8_t data[(1 + lcdColumns) * 6];
+  uint8_t length = 0;
+
+  if (lcdInitStep < lcdInitStepCount)
+  {
+    if (clockMicros() < lcdNextStepTime)
+    {
+      return;
+    }
+
+    const LcdInitStep &step = lcdInitSteps[lcdInitStep];
+    length = step.nibble ? lcdEncodeNibble(data, step.value, 0) : lcdEncodeByte(data, step.value, 0);
+
+    if (twiWrite(lcdAddress, data, length))
+    {
+      lcdInitStep++;
+      lcdNextStepTime = clockMicros() + step.delay;
+
+      // the display lost its content with the power-on
+      if (lcdInitStep == lcdInitStepCount)
+      {
+        for (int line = 0; line < lcdRows; line++)
+        {
+          lcdDirty[line] = true;
+        }
+      }
+    }
+    return;
+  }
+
+  for (int line = 0; line < lcdRows; line++)
+  {
+    if (!lcdDirty[line])
+    {
+      continue;
+    }
+
+    length = lcdEncodeByte(data, lcdSetDdramAddress | (line ? lcdSecondLineAddress : 0), 0);
+    for (int i = 0; i < lcdColumns; i++)
+    {
+      length += lcdEncodeByte(data + length, lcdFrame[line][i], lcdRegisterSelect);
+    }
+
+    if (twiWrite(lcdAddress, data, length))
+    {
+      lcdDirty[line] = false;
+    }
+    return;
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef LCD_H
+#define LCD_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Size of the 16x2 character display
+const int lcdColumns = 16;
+const int lcdRows = 2;
+
+/**
+ * @brief Starts the HD44780 display behind a PCF8574 I2C backpack.
+ *
+ * The bus runs at 400 kHz. The power-on initialization sequence of the display is sent by
+ * lcdPoll() step by step, so this call returns immediately.
+ *
+ * @param address The I2C address of the backpack.
+ *
+ * @return void
+ */
+void lcdBegin(uint8_t address);
+
+/**
+ * @brief Sets the text of a display line.
+ *
+ * The text is copied into the frame buffer, padded with spaces to the width of the display, and
+ * sent to the display by lcdPoll(). Lines that do not change are not sent again.
+ *
+ * @param line The line number on the display (0-indexed).
+ * @param text The text, longer text is cut off.
+ *
+ * @return void
+ */
+void lcdSetLine(uint8_t line, const char *text);
+
+/**
+ * @brief Advances the initialization and queues one changed line for the TWI interrupt.
+ *
+ * Nothing is queued while the TWI queue has no room, so the call never waits for the bus.
+ *
+ * @return void
+ */
+void lcdPoll();
+
+#endif
@@ -0,0 +1,53 @@
+#include "linearisation.h"
+
+// Placeholder calibration points, not measured: the high-flow K-factor of the datasheets (YF-S201
+// F = 7.5 Q, 450/l; FS300A F = 5.5 Q, 330/l) with an assumed fall at low flow. Replace them with
+// the linearity bins `analyze` reports for captures of the meters on the rig.
+constexpr CalibrationPoint yfs201Points[] = {
+    {7.5f, 381.0f}, {15.0f, 421.0f}, {30.0f, 444.0f}, {60.0f, 452.0f}, {112.5f, 455.0f}, {225.0f, 450.0f},
+};
+constexpr CalibrationPoint fs300aPoints[] = {
+    {11.0f, 291.0f}, {27.5f, 319.0f}, {55.0f, 332.0f}, {110.0f, 335.0f}, {220.0f, 330.0f},
+};
+
+static_assert(validCalibration(yfs201Points), "YF-S201 calibration points must be sorted by rate");
+static_assert(validCalibration(fs300aPoints), "FS300A calibration points must be sorted by rate");
+
+// Generated by the compiler, stored in flash only
+constexpr LinearisationTable linearisationTables[METER_TYPES] PROGMEM = {
+    makeLinearisationTable(yfs201Points),
+    makeLinearisationTable(fs300aPoints),
+};
+
+uint32_t nanolitresPerPulse(uint8_t meter, unsigned long rate)
+{
+  if (meter >= METER_TYPES)
+  {
+    meter = METER_YFS201;
+  }
+  const uint32_t *entries = linearisationTables[meter].nanolitresPerPulse;
+
+  unsigned long index = rate >> linearisationShift;
+  if (index >= linearisationSize - 1)
+  {
+    return pgm_read_dword(&entries[linearisationSize - 1]);
+  }
+
+  uint32_t low = pgm_read_dword(&entries[index]);
+  uint32_t high = pgm_read_dword(&entries[index + 1]);
+  int32_t fraction = rate & ((1 << linearisationShift) - 1);
+  return low + (int32_t)(high - low) * fraction / (1 << linearisationShift);
+}
+
+const char *meterName(uint8_t meter)
+{
+  switch (meter)
+  {
+  case METER_YFS201:
+    return "YF-S201";
+  case METER_FS300A:
+    return "FS300A";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef LINEARISATION_H
+#define LINEARISATION_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Meter types with a linearisation table
+enum MeterType
+{
+  METER_YFS201,
+  METER_FS300A,
+  METER_TYPES
+};
+
+/**
+ * A calibration point of a meter: the K-factor measured at a pulse rate.
+ */
+struct CalibrationPoint
+{
+  float rate;    // pulses per second
+  float kFactor; // pulses per litre
+};
+
+// Defines for Linearisation: one entry every 8 Hz, from 0 to 248 Hz
+const uint8_t linearisationShift = 3;
+const uint8_t linearisationSize = 32;
+
+/**
+ * Volume per pulse of a meter over the pulse rate, on a uniform rate grid.
+ */
+struct LinearisationTable
+{
+  uint32_t nanolitresPerPulse[linearisationSize];
+};
+
+/**
+ * @brief Checks that calibration points are sorted by rate and have positive K-factors.
+ *
+ * @param points The calibration points.
+ *
+ * @return bool True if a table can be made from the points.
+ */
+template <size_t N>
+constexpr bool validCalibration(const CalibrationPoint (&points)[N])
+{
+  for (size_t i = 0; i < N; i++)
+  {
+    if (points[i].kFactor <= 0 || (i > 0 && points[i].rate <= points[i - 1].rate))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Makes the linearisation table of a meter from its calibration points at compile time.
+ *
+ * The K-factor is interpolated linearly between the points and held constant outside of them.
+ *
+ * @param points The calibration points, sorted by rate.
+ *
+ * @return LinearisationTable The table, to be placed in PROGMEM.
+ */
+template <size_t N>
+constexpr LinearisationTable makeLinearisationTable(const CalibrationPoint (&points)[N])
+{
+  LinearisationTable table{};
+  for (uint8_t i = 0; i < linearisationSize; i++)
+  {
+    float rate = (float)((unsigned)i << linearisationShift);
+    float kFactor = points[N - 1].kFactor;
+    for (size_t p = 0; p < N; p++)
+    {
+      if (rate < points[p].rate)
+      {
+        kFactor = p == 0 ? points[0].kFactor
+                         : points[p - 1].kFactor + (points[p].kFactor - points[p - 1].kFactor) *
+                                                       (rate - points[p - 1].rate) / (points[p].rate - points[p - 1].rate);
+        break;
+      }
+    }
+    table.nanolitresPerPulse[i] = (uint32_t)(1e9f / kFactor + 0.5f);
+  }
+  return table;
+}
+
+/**
+ * @brief Returns the corrected volume of one pulse of a meter at a pulse rate.
+ *
+ * Interpolates between two entries of the table in flash; the cost is the same for every rate.
+ *
+ * @param meter The meter type, METER_YFS201 if out of range.
+ * @param rate The pulse rate in pulses per second.
+ *
+ * @return uint32_t The volume per pulse in nanolitres.
+ */
+uint32_t nanolitresPerPulse(uint8_t meter, unsigned long rate);
+
+/**
+ * @brief Names a meter type, e.g. for the display.
+ *
+ * @param meter The meter type.
+ *
+ * @return const char* The name, "?" if out of range.
+ */
+const char *meterName(uint8_t meter);
+
+#endif
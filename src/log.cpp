@@ -0,0 +1,116 @@
+#include "log.h"
+
+// Size of the ring buffer, a power of two
+const unsigned int logBufferSize = 256;
+
+// Longest line sent ahead of the queue by logLineFirst()
+const unsigned int logFirstSize = 40;
+
+static char logBuffer[logBufferSize];
+static uint8_t logEnds[logBufferSize / 8]; // bit set on the last byte of every line and data block
+static unsigned int logHead = 0;
+static unsigned int logTail = 0;
+static bool logAtBoundary = true; // the last byte sent ended a line or data block
+static char logFirst[logFirstSize];
+static bool logFirstPending = false;
+
+static unsigned int logQueued()
+{
+  return (logHead - logTail) & (logBufferSize - 1);
+}
+
+/**
+ * Writes a line waiting in logFirst if the output is between two lines or data blocks and the
+ * line with its ending fits into room bytes. Returns the number of bytes written.
+ */
+static int logSendFirst(int room)
+{
+  if (!logFirstPending || !logAtBoundary)
+  {
+    return 0;
+  }
+  int length = strlen(logFirst) + 2;
+  if (length > room)
+  {
+    return 0;
+  }
+  Serial.write(logFirst);
+  Serial.write("\r\n");
+  logFirstPending = false;
+  return length;
+}
+
+/**
+ * Writes the oldest queued byte to the serial port.
+ */
+static void logSend()
+{
+  uint8_t mask = 1 << (logTail & 7);
+  logAtBoundary = logEnds[logTail >> 3] & mask;
+  logEnds[logTail >> 3] &= ~mask;
+  Serial.write(logBuffer[logTail]);
+  logTail = (logTail + 1) & (logBufferSize - 1);
+}
+
+static void logPut(char c, bool end)
+{
+  // one slot stays free to tell a full buffer from an empty one
+  if (logQueued() == logBufferSize - 1)
+  {
+    // pushing out waits for the UART anyway
+    logSendFirst(logFirstSize + 2);
+    logSend();
+  }
+
+  logBuffer[logHead] = c;
+  if (end)
+  {
+    logEnds[logHead >> 3] |= 1 << (logHead & 7);
+  }
+  logHead = (logHead + 1) & (logBufferSize - 1);
+}
+
+void logLine(const String &line)
+{
+  for (unsigned int i = 0; i < line.length(); i++)
+  {
+    logPut(line[i], false);
+  }
+  logPut('\r', false);
+  logPut('\n', true);
+}
+
+void logLineFirst(const String &line)
+{
+  // a line that is still waiting is replaced, the newer one is what the host asked for last
+  strncpy(logFirst, line.c_str(), logFirstSize - 1);
+  logFirst[logFirstSize - 1] = '\0';
+  logFirstPending = true;
+  logSendFirst(Serial.availableForWrite());
+}
+
+void logBytes(const uint8_t *data, unsigned int length, bool end)
+{
+  for (unsigned int i = 0; i < length; i++)
+  {
+    logPut(data[i], end && i == length - 1);
+  }
+}
+
+unsigned int logSpace()
+{
+  return logBufferSize - 1 - logQueued();
+}
+
+void logFlush()
+{
+  int room = Serial.availableForWrite();
+
+  room -= logSendFirst(room);
+  while (room > 0 && logTail != logHead)
+  {
+    logSend();
+    room--;
+    room -= logSendFirst(room);
+  }
+}
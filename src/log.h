@@ -0,0 +1,63 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Queues a line for the serial monitor.
+ *
+ * The line is copied into a ring buffer and sent by logFlush(), so callers do not wait for the
+ * UART. When the ring buffer is full the oldest bytes are pushed out synchronously; lines are
+ * never dropped, because they carry the measurement results.
+ *
+ * @param line The text to send, without line ending.
+ *
+ * @return void
+ */
+void logLine(const String &line);
+
+/**
+ * @brief Sends a line ahead of the queued output, e.g. an answer whose delay the host measures.
+ *
+ * The line is written to the serial port right away if the output is between two lines or data
+ * blocks and the transmit buffer has room for it, else by logFlush() as soon as both hold. The
+ * line is cut to 39 characters.
+ *
+ * @param line The text to send, without line ending.
+ *
+ * @return void
+ */
+void logLineFirst(const String &line);
+
+/**
+ * @brief Queues binary data for the serial monitor, e.g. a frame of the pulse stream.
+ *
+ * The data is sent between two lines, without line ending. Like logLine() it pushes out the oldest
+ * bytes when the ring buffer is full; check logSpace() first. A block queued in several calls
+ * passes end only with its last part, so logLineFirst() does not cut into it.
+ *
+ * @param data The bytes to send.
+ * @param length The number of bytes.
+ * @param end True if the block ends with these bytes.
+ *
+ * @return void
+ */
+void logBytes(const uint8_t *data, unsigned int length, bool end = true);
+
+/**
+ * @brief Returns the number of bytes that can be queued without pushing out older output.
+ *
+ * @return unsigned int The free space in the ring buffer, including the line ending.
+ */
+unsigned int logSpace();
+
+/**
+ * @brief Moves queued bytes into the serial transmit buffer without blocking.
+ *
+ * Only as many bytes as the transmit buffer can take are moved on each call.
+ *
+ * @return void
+ */
+void logFlush();
+
+#endif
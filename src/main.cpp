@@ -1,8 +1,25 @@
 #include <Arduino.h>
-#include <Wire.h>
-#include <LiquidCrystal_I2C.h>
 #include <limits.h>
 #include <SPI.h>
+#include <util/atomic.h>
+
+#include "board.h"
+#include "clock.h"
+#include "commands.h"
+#include "console.h"
+#include "estop.h"
+#include "histogram.h"
+#include "lcd.h"
+#include "log.h"
+#include "measurement.h"
+#include "memory.h"
+#include "meters.h"
+#include "scale.h"
+#include "scheduler.h"
+#include "selftest.h"
+#include "stream.h"
+#include "trace.h"
+#include "ui.h"
 
 // Defines for Pins
 const int flowMeterPin = 2;
@@ -12,246 +29,351 @@ const int buttonPin3Second = 9;
 const int buttonPin10Second = 10;
 const int buttonPin100Second = 11;
 
-// define variables
-int pulses = 0;
-volatile bool isRunning = false;
-unsigned long lastDebounceTime = 0;
-unsigned long debounceDelay = 500;
+// Defines for Buttons
+const uint32_t debounceDelay = 30000;
+const uint32_t longPressDelay = 1000000;
+
+/**
+ * A button: the run a long press starts, and the debounced state.
+ */
+struct Button
+{
+  int pin;
+  unsigned int seconds; // seconds of the run started by a long press
+  bool splitted;        // the run is split into 10 cycles
+  bool down = false;
+  bool longPressed = false;
+  uint64_t changed = 0;
+};
+
+enum ButtonEvent
+{
+  BUTTON_NONE,
+  BUTTON_SHORT, // released before the long press delay
+  BUTTON_LONG   // held for the long press delay, reported once while held
+};
+
+// Button table: pin, seconds and split of the run started by a long press
+Button buttons[] = {
+    {buttonPin1Second, 1, true},
+    {buttonPin3Second, 3, true},
+    {buttonPin10Second, 10, false},
+    {buttonPin100Second, 100, false},
+};
+const uint8_t buttonCount = sizeof(buttons) / sizeof(buttons[0]);
+
+// Defines for Serial
+const unsigned long serialBaud = 115200;
 
 // Defines for Display
 int i2cAddress = 0x3F;
-int lcdColumns = 16;
-int lcdRows = 2;
+
+// Defines for Scale
+const unsigned long scaleBaud = 9600;
+const bool scaleOnRequest = false;
+
 /**
- * @brief Initializes the LCD display with the specified I2C address, number of columns, and rows.
+ * @brief Writes a given string to a specified line of the LCD display.
  *
- * This function sets up the LiquidCrystal_I2C library with the provided parameters. It configures the
- * LCD display to communicate with the Arduino using the I2C protocol.
+ * The string is kept on the status page of the display, which the display task renders when it is
+ * shown. If no line is specified, the string is written to the first line.
  *
- * @param i2cAddress The I2C address of the LCD display.
- * @param lcdColumns The number of columns on the LCD display.
- * @param lcdRows The number of rows on the LCD display.
+ * @param string_to_write The string to be written to the LCD display.
+ * @param line The line number on the LCD display (0-indexed). Default value is 0.
  *
  * @return void
  */
-LiquidCrystal_I2C lcd(i2cAddress, lcdColumns, lcdRows);
+void writeToDisplay(const String string_to_write, const int line)
+{
+  uiSetStatus(line, string_to_write.c_str());
+}
 
 /**
- * Count the pulses from the flow meter
- * Triggerd by the intterrupt
+ * @brief Opens or closes the valve. The valve is open while the pin is LOW. It stays closed while
+ * the emergency stop is engaged.
+ *
+ * The check and the write are atomic: a stop between them would otherwise reopen the valve that
+ * its interrupt has just closed.
+ *
+ * @param open True to open the valve.
+ *
+ * @return void
  */
-void countPulse()
+void setValve(bool open)
 {
-  pulses++;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    digitalWrite(valve, open && !estopEngaged() ? LOW : HIGH);
+  }
 }
 
 /**
- * Clear the LCD-Display line with spaces
+ * @brief Debounces a button and tells short from long presses.
+ *
+ * A change of the pin within the debounce delay of the last change is bounce and ignored.
+ *
+ * @param button The button.
  *
- * @param line numberof line (0-indexed) on the LCD-Display to clear.
+ * @return ButtonEvent The press that was completed by this call, if any.
  */
-void clearLine(int line)
+ButtonEvent pollButton(Button &button)
 {
-  lcd.setCursor(0, line);
-  for (int i = 0; i < lcdColumns; i++)
+  bool down = digitalRead(button.pin) == LOW;
+  uint64_t now = clockMicros();
+
+  if (down != button.down)
   {
-    lcd.print(" ");
+    if (now - button.changed < debounceDelay)
+    {
+      return BUTTON_NONE;
+    }
+    button.down = down;
+    button.changed = now;
+    if (down)
+    {
+      button.longPressed = false;
+      traceEvent(TRACE_BUTTON, button.pin);
+      return BUTTON_NONE;
+    }
+    return button.longPressed ? BUTTON_NONE : BUTTON_SHORT;
   }
+
+  if (down && !button.longPressed && now - button.changed >= longPressDelay)
+  {
+    button.longPressed = true;
+    return BUTTON_LONG;
+  }
+  return BUTTON_NONE;
 }
 
 /**
- * @brief Writes a given string to a specified line of the LCD display.
- *
- * This function clears the specified line of the LCD display, sets the cursor to the beginning of the line,
- * and then prints the given string. If no line is specified, the string is written to the first line.
+ * @brief Task: scans the buttons. Short presses navigate the display, long presses start runs.
  *
- * @param string_to_write The string to be written to the LCD display.
- * @param line The line number on the LCD display (0-indexed). Default value is 0.
+ * Buttons 1 and 2 step to the previous and the next page, button 3 shows the status and button 4
+ * the last result. A long press starts the run of the button, unless a measurement is running.
  *
  * @return void
  */
-void writeToDisplay(const String string_to_write, const int line = 0)
+void scanButtonsTask()
 {
-  clearLine(line);
-  lcd.setCursor(0, line);
-  lcd.print(string_to_write);
+  for (uint8_t i = 0; i < buttonCount; i++)
+  {
+    ButtonEvent event = pollButton(buttons[i]);
+    if (event == BUTTON_SHORT)
+    {
+      switch (i)
+      {
+      case 0:
+        uiPreviousPage();
+        break;
+      case 1:
+        uiNextPage();
+        break;
+      case 2:
+        uiShowPage(UI_STATUS);
+        break;
+      default:
+        uiShowPage(UI_RESULT);
+        break;
+      }
+    }
+    else if (event == BUTTON_LONG && measurement.state == MEASUREMENT_IDLE)
+    {
+      const Button &button = buttons[i];
+      logLine("Button " + String(button.seconds) + "s pressed");
+      if (button.splitted)
+      {
+        runMessurementSplitted(button.seconds);
+      }
+      else
+      {
+        runMessurementFull(button.seconds);
+      }
+      uiShowPage(UI_PROGRESS);
+    }
+  }
 }
 
 /**
- * @brief Initializes the Arduino setup.
- *
- * This function sets up the serial communication, initializes the LCD display, configures the pins,
- * attaches an interrupt to the flow meter pin, and sets the valve pin to HIGH.
+ * @brief Task: renders one line of the shown page, advances the LCD initialization and queues
+ * changed lines for the TWI interrupt.
  *
  * @return void
  */
-void setup()
+void refreshDisplayTask()
 {
-  // init serial monitor
-  Serial.begin(9600);
-
-  // display
-  lcd.init();
-  lcd.begin(lcdColumns, lcdRows);
-  lcd.backlight();
-  lcd.setBacklight(HIGH);
-
-  // Config Pins
-  pinMode(flowMeterPin, INPUT_PULLUP);
-  pinMode(valve, OUTPUT);
-  pinMode(buttonPin1Second, INPUT_PULLUP);
-  pinMode(buttonPin3Second, INPUT_PULLUP);
-  pinMode(buttonPin10Second, INPUT_PULLUP);
-  pinMode(buttonPin100Second, INPUT_PULLUP);
-
-  attachInterrupt(digitalPinToInterrupt(flowMeterPin), countPulse, FALLING);
+  uiPoll();
+  lcdPoll();
+}
 
-  digitalWrite(valve, HIGH);
+/**
+ * @brief Task: reads the scale.
+ *
+ * @return void
+ */
+void scaleTask()
+{
+  scalePoll();
+}
 
-  writeToDisplay("Ready");
+/**
+ * @brief Task: sends queued trace events, histogram bins and log output to the serial monitor.
+ *
+ * @return void
+ */
+void flushSerialTask()
+{
+  traceFlush();
+  streamFlush();
+  histogramFlush();
+  logFlush();
 }
 
 /**
- * @brief Runs a full measurement with the valve open for a specified number of seconds.
+ * @brief Task: runs commands received on the serial monitor.
  *
- * This function measures the flow rate by counting the pulses from a flow meter.
- * The valve is opened for the specified number of seconds, then closed, and the total number of pulses
- * is displayed on the LCD.
+ * @return void
+ */
+void commandsTask()
+{
+  commandsPoll();
+}
+
+/**
+ * @brief Command "mem": logs the static memory, the heap and stack high-water marks and the free memory.
  *
- * @param seconds The number of seconds the valve should be open.
+ * @param args Unused.
  *
  * @return void
  */
-void runMessurementFull(unsigned long seconds)
+void memCommand(const char *)
 {
-  pulses = 0;
-  writeToDisplay("Running ");
-  writeToDisplay(String(seconds) + " seconds", 1);
-
-  Serial.println("Measurement starts with " + String(seconds) + "s");
+  memoryReport();
+}
 
-  unsigned long startTime = millis();
-  unsigned long measuermentTimeMiliSeconds = seconds * 1000;
-  unsigned long stoptime = startTime + (measuermentTimeMiliSeconds);
-  unsigned long previousMillis = 0;
+/**
+ * @brief Task: logs the runtime, the pulse rate since the previous report (or the gate start) and
+ * the volume corrected for the rate while a measurement runs.
+ *
+ * @return void
+ */
+void statsTask()
+{
+  logStats();
+}
 
-  digitalWrite(valve, LOW);
+// Task table: name, period and deadline in microseconds, function
+const Task tasks[] = {
+    {"buttons", 10000, 10000, scanButtonsTask},
+    {"serial", 5000, 5000, flushSerialTask},
+    {"display", 20000, 20000, refreshDisplayTask},
+    {"scale", 50000, 50000, scaleTask},
+    {"commands", 20000, 20000, commandsTask},
+    {"stats", 1000000, 50000, statsTask},
+};
+const uint8_t taskCount = sizeof(tasks) / sizeof(tasks[0]);
+TaskStats taskStats[taskCount];
+
+// Command table: name, function
+const Command commands[] = {
+    {"trace", traceCommand},
+    {"job", jobCommand},
+    {"selftest", selfTestCommand},
+    {"mem", memCommand},
+    {"hist", histCommand},
+    {"sync", syncCommand, true},
+    {"meter", meterCommand},
+};
+const uint8_t commandCount = sizeof(commands) / sizeof(commands[0]);
 
-  while (millis() <= stoptime)
+/**
+ * @brief Names the cause of the last reset from the MCU status register.
+ *
+ * @param resetFlags The value of MCUSR read at boot.
+ *
+ * @return String The cause of the reset.
+ */
+String resetCause(uint8_t resetFlags)
+{
+  if (resetFlags & _BV(BORF))
   {
-    // print the seconds of the runtime
-    if (millis() / 1000 == previousMillis)
-    {
-      previousMillis = millis() / 1000;
-      Serial.println("Time: " + String(previousMillis) + "s");
-    }
+    return "brown-out";
   }
-
-  digitalWrite(valve, HIGH);
-
-  Serial.println("Pulses: " + String(pulses));
-
-  writeToDisplay("Pulses");
-  writeToDisplay(String(pulses), 1);
+  if (resetFlags & _BV(WDRF))
+  {
+    return "watchdog";
+  }
+  if (resetFlags & _BV(EXTRF))
+  {
+    return "external";
+  }
+  if (resetFlags & _BV(PORF))
+  {
+    return "power-on";
+  }
+  return "unknown";
 }
 
 /**
- * @brief Runs a split measurement with the valve open for a specified number of seconds, repeated 10 times.
- *
- * This function measures the flow rate by counting the pulses from a flow meter.
- * The valve is opened for the specified number of seconds, then closed, and this process is repeated 10 times.
- * The total number of pulses is then displayed on the LCD.
+ * @brief Initializes the Arduino setup.
  *
- * @param seconds The number of seconds the valve should be open for each cycle.
+ * The valve is forced closed, pulse counting starts and the emergency stop is armed first, so the
+ * board counts and can be stopped within microseconds of a reset. Serial output is queued and the
+ * LCD is initialized in the background by the display task. The time from the start of setup()
+ * until the board is ready is logged.
  *
  * @return void
  */
-void runMessurementSplitted(unsigned int seconds)
+void setup()
 {
-  pulses = 0;
-  writeToDisplay("Running " + String(seconds) + " seconds");
+  uint8_t resetFlags = MCUSR;
+  MCUSR = 0;
 
-  Serial.println("Splitted measurement starts with 10x " + String(seconds) + "s");
+  // start the time base before anything is timed
+  clockBegin();
 
-  for (int i = 0; i < 10; i++)
-  {
-    unsigned long startTime = millis();
-    unsigned int cycle = i + 1;
+  // valve-safe state: drive the pin high before it becomes an output, so it never opens
+  digitalWrite(valve, HIGH);
+  pinMode(valve, OUTPUT);
 
-    writeToDisplay("Cycle: " + String(cycle), 1);
-    digitalWrite(valve, LOW);
+  // count falling edges right away; the registry switches to the edge of the stored meter later
+  pinMode(flowMeterPin, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(flowMeterPin), countPulse, FALLING);
 
-    unsigned long measuermentTimeMiliSeconds = seconds * 1000;
-    unsigned long stoptime = startTime + (measuermentTimeMiliSeconds);
-    unsigned long previousMillis = 0;
+  estopBegin();
 
-    while (millis() <= stoptime)
-    {
-      // print the seconds of the runtime
-      if (millis() / 1000 == previousMillis)
-      {
-        previousMillis = millis() / 1000;
-        Serial.println("Time: " + String(previousMillis) + "s");
-      }
-    }
+  // after the emergency stop, as formatting a blank registry takes a while on the first boot
+  metersBegin(flowMeterPin);
 
-    digitalWrite(valve, HIGH);
+  for (uint8_t i = 0; i < buttonCount; i++)
+  {
+    pinMode(buttons[i].pin, INPUT_PULLUP);
+  }
 
-    startTime = millis();
-    unsigned long waitTime = 0;
+  schedulerBegin();
 
-    // pause for 2 seconds after each cycle
-    while (waitTime < 2000)
-    {
-      waitTime = millis() - startTime;
-    }
-  }
+  uint64_t readyTime = clockMicros();
+
+  // init serial monitor, the output is sent by the serial task
+  Serial.begin(serialBaud);
+  logLine("Reset: " + resetCause(resetFlags));
+  logLine("Boot: " + microsToString(readyTime) + "us");
 
-  Serial.println("Pulses: " + String(pulses));
+  lcdBegin(i2cAddress);
+  scaleBegin(Serial1, scaleBaud, scaleOnRequest);
 
-  writeToDisplay("Pulses");
-  writeToDisplay(String(pulses), 1);
+  writeToDisplay("Ready");
+  writeToDisplay("", 1);
 }
 
 void loop()
 {
-  if (digitalRead(buttonPin1Second) == LOW)
+  estopPoll();
+  commandsReceive();
+  if (pollMeasurement() || pollSelfTest())
   {
-    if ((millis() - lastDebounceTime) > debounceDelay)
-    {
-      Serial.println("Button 1s pressed");
-      runMessurementSplitted(1);
-    }
-    lastDebounceTime = millis();
-  }
-
-  if (digitalRead(buttonPin3Second) == LOW)
-  {
-    if ((millis() - lastDebounceTime) > debounceDelay)
-    {
-      Serial.println("Button 3s pressed");
-      runMessurementSplitted(3);
-    }
-    lastDebounceTime = millis();
-  }
-
-  if (digitalRead(buttonPin10Second) == LOW)
-  {
-    if ((millis() - lastDebounceTime) > debounceDelay)
-    {
-      Serial.println("Button 10s pressed");
-      runMessurementFull(10);
-    }
-    lastDebounceTime = millis();
-  }
-
-  if (digitalRead(buttonPin100Second) == LOW)
-  {
-    if ((millis() - lastDebounceTime) > debounceDelay)
-    {
-      Serial.println("Button 100s pressed");
-      runMessurementFull(100);
-    }
-    lastDebounceTime = millis();
+    schedulerReport();
+    memoryReport();
   }
+  schedulerDispatch();
 }
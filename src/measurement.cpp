@@ -0,0 +1,387 @@
+#include "measurement.h"
+
+#include "board.h"
+#include "clock.h"
+#include "histogram.h"
+#include "log.h"
+#include "meters.h"
+#include "scale.h"
+#include "selftest.h"
+#include "stream.h"
+#include "trace.h"
+
+// Defines for Measurement
+const unsigned long scaleSettleTimeout = 30000000;
+const unsigned long maxJobSeconds = 3600;
+const unsigned long maxJobCycles = 100;
+
+volatile unsigned long pulses = 0;
+Measurement measurement;
+
+void countPulse()
+{
+  if (!meterAcceptPulse())
+  {
+    return;
+  }
+  pulses++;
+  histogramPulse();
+  if (!streamPulse())
+  {
+    traceEvent(TRACE_PULSE);
+  }
+}
+
+/**
+ * Switches the valve and records the change in the trace.
+ */
+static void switchValve(bool open)
+{
+  setValve(open);
+  traceEvent(TRACE_VALVE, open);
+}
+
+unsigned long readPulses()
+{
+  noInterrupts();
+  unsigned long count = pulses;
+  interrupts();
+  return count;
+}
+
+void addVolume(unsigned long count, unsigned long rate)
+{
+  measurement.volume += (uint64_t)(count - measurement.pulsesAtLastStats) * meterNanolitresPerPulse(rate);
+  measurement.pulsesAtLastStats = count;
+}
+
+void logStats()
+{
+  if (measurement.state != MEASUREMENT_GATE)
+  {
+    return;
+  }
+
+  // the caller is not aligned to the gate start, so the rate is over the time since the last sample
+  uint64_t now = clockMicros();
+  unsigned long count = readPulses();
+  unsigned long elapsedSeconds = (now - measurement.phaseStart) / 1000000ULL;
+  uint64_t sampleMicros = now - measurement.statsTime;
+  unsigned long rate =
+      sampleMicros > 0 ? (uint64_t)(count - measurement.pulsesAtLastStats) * 1000000ULL / sampleMicros : 0;
+  measurement.statsTime = now;
+  addVolume(count, rate);
+
+  logLine("Time: " + String(elapsedSeconds) + "s Rate: " + String(rate) + "/s Volume: " +
+          String(measurement.volume / 1000000.0, 1) + "ml");
+}
+
+/**
+ * @brief Logs the pulses counted during the gate and the pause of the cycle that just ended.
+ *
+ * The pulses since the last stats sample are added to the volume at the mean rate of the cycle,
+ * and the cycle is added to the cycle statistics.
+ *
+ * @return void
+ */
+static void endCycle()
+{
+  unsigned long count = readPulses();
+  unsigned long cyclePulses = count - measurement.pulsesAtCycleStart;
+  addVolume(count, cyclePulses / measurement.seconds);
+  logLine("Cycle " + String(measurement.cycle) + ": " + String(cyclePulses) + " pulses");
+  measurement.pulsesAtCycleStart = count;
+
+  if (measurement.cyclesDone == 0 || cyclePulses < measurement.cycleMinPulses)
+  {
+    measurement.cycleMinPulses = cyclePulses;
+  }
+  if (measurement.cyclesDone == 0 || cyclePulses > measurement.cycleMaxPulses)
+  {
+    measurement.cycleMaxPulses = cyclePulses;
+  }
+  measurement.cyclePulseSum += cyclePulses;
+  measurement.cyclesDone++;
+}
+
+/**
+ * @brief Opens the valve and starts a gate of the current cycle.
+ *
+ * @return void
+ */
+static void startGate()
+{
+  measurement.cycle++;
+  measurement.state = MEASUREMENT_GATE;
+  measurement.phaseStart = clockMicros();
+  measurement.phaseEnd = measurement.phaseStart + measurement.seconds * 1000000ULL;
+  measurement.statsTime = measurement.phaseStart;
+
+  switchValve(true);
+  histogramEnable(true);
+
+  if (measurement.cycles > 1)
+  {
+    writeToDisplay("Cycle: " + String(measurement.cycle), 1);
+  }
+}
+
+/**
+ * @brief Resets the pulse counter and opens the valve for the first cycle.
+ *
+ * @return void
+ */
+static void startCycles()
+{
+  noInterrupts();
+  pulses = 0;
+  interrupts();
+
+  measurement.runStart = clockMicros();
+  measurement.pulsesAtCycleStart = 0;
+  startGate();
+}
+
+void startMeasurement(unsigned long seconds, unsigned int cycles)
+{
+  traceEvent(TRACE_START, seconds, cycles);
+
+  measurement.seconds = seconds;
+  measurement.cycles = cycles;
+  measurement.cycle = 0;
+  measurement.cyclesDone = 0;
+  measurement.cyclePulseSum = 0;
+  measurement.gateTime = 0;
+  measurement.pulsesAtLastStats = 0;
+  measurement.volume = 0;
+  measurement.useScale = scalePresent();
+  measurement.tare = 0;
+  measurement.aborted = false;
+  histogramReset();
+  meterTakeGlitches();
+
+  if (measurement.useScale)
+  {
+    measurement.state = MEASUREMENT_TARE;
+    measurement.phaseStart = clockMicros();
+    measurement.phaseEnd = measurement.phaseStart + scaleSettleTimeout;
+    return;
+  }
+
+  startCycles();
+}
+
+/**
+ * @brief Logs the result of the measurement and starts sending the pulse interval histogram.
+ *
+ * With a scale, the weight of the water is paired with the pulse count.
+ *
+ * @return void
+ */
+static void finishMeasurement()
+{
+  unsigned long count = readPulses();
+  measurement.state = MEASUREMENT_IDLE;
+  traceEvent(TRACE_FINISH);
+
+  logLine("Timestamp: " + microsToString(measurement.runStart) + "us");
+  logLine("Gate: " + microsToString(measurement.gateTime) + "us");
+  logLine("Pulses: " + String(count));
+  logLine("Volume: " + String(measurement.volume / 1000000.0, 2) + "ml");
+  unsigned long glitches = meterTakeGlitches();
+  if (glitches > 0)
+  {
+    logLine("Glitches: " + String(glitches));
+  }
+
+  writeToDisplay("Pulses");
+
+  measurement.pulseCount = count;
+  measurement.weight = 0;
+
+  if (measurement.useScale)
+  {
+    measurement.weight = scaleWeight() - measurement.tare;
+    logLine("Weight: " + String(measurement.weight, 1) + "g" + (scaleSettled() ? "" : " (unsettled)"));
+    writeToDisplay(String(count) + " " + String(measurement.weight, 1) + "g", 1);
+  }
+  else
+  {
+    writeToDisplay(String(count), 1);
+  }
+
+  histogramReport();
+}
+
+/**
+ * @brief Ends the last cycle and waits for the scale to settle, if one is used.
+ *
+ * @param now The current time.
+ *
+ * @return void
+ */
+static void endCycles(uint64_t now)
+{
+  endCycle();
+
+  if (!measurement.useScale)
+  {
+    finishMeasurement();
+    return;
+  }
+
+  writeToDisplay("Weighing", 1);
+  measurement.state = MEASUREMENT_WEIGH;
+  measurement.phaseStart = now;
+  measurement.phaseEnd = now + scaleSettleTimeout;
+}
+
+bool pollMeasurement()
+{
+  uint64_t now = clockMicros();
+  bool running = measurement.state != MEASUREMENT_IDLE && measurement.state != MEASUREMENT_SELFTEST &&
+                 measurement.state != MEASUREMENT_STOPPED;
+
+  switch (measurement.state)
+  {
+  case MEASUREMENT_IDLE:
+  case MEASUREMENT_SELFTEST:
+  case MEASUREMENT_STOPPED:
+    break;
+
+  case MEASUREMENT_TARE:
+    if (scaleSettled() || now >= measurement.phaseEnd)
+    {
+      measurement.tare = scaleWeight();
+      logLine("Tare: " + String(measurement.tare, 1) + "g" + (scaleSettled() ? "" : " (unsettled)"));
+      startCycles();
+    }
+    break;
+
+  case MEASUREMENT_GATE:
+    if (now < measurement.phaseEnd)
+    {
+      break;
+    }
+
+    switchValve(false);
+    histogramEnable(false);
+    measurement.gateTime += now - measurement.phaseStart;
+
+    if (measurement.cycles == 1)
+    {
+      endCycles(now);
+      break;
+    }
+
+    // pause for 2 seconds after each cycle
+    measurement.state = MEASUREMENT_PAUSE;
+    measurement.phaseStart = now;
+    measurement.phaseEnd = now + measurementPauseMicros;
+    break;
+
+  case MEASUREMENT_PAUSE:
+    if (now < measurement.phaseEnd)
+    {
+      break;
+    }
+
+    if (measurement.cycle < measurement.cycles)
+    {
+      endCycle();
+      startGate();
+    }
+    else
+    {
+      endCycles(now);
+    }
+    break;
+
+  case MEASUREMENT_WEIGH:
+    if (scaleSettled() || now >= measurement.phaseEnd)
+    {
+      finishMeasurement();
+    }
+    break;
+  }
+
+  return running && measurement.state == MEASUREMENT_IDLE;
+}
+
+void abortMeasurement(unsigned long count)
+{
+  if (measurement.state == MEASUREMENT_SELFTEST)
+  {
+    abortSelfTest();
+    measurement.state = MEASUREMENT_STOPPED;
+    return;
+  }
+
+  bool running = measurement.state != MEASUREMENT_IDLE && measurement.state != MEASUREMENT_STOPPED;
+  measurement.state = MEASUREMENT_STOPPED;
+  if (!running)
+  {
+    return;
+  }
+
+  switchValve(false);
+  histogramEnable(false);
+  traceEvent(TRACE_FINISH);
+
+  measurement.pulseCount = count;
+  measurement.weight = 0;
+  measurement.aborted = true;
+
+  logLine("Aborted: " + String(count) + " pulses");
+  writeToDisplay("Aborted");
+  writeToDisplay(String(count), 1);
+}
+
+void releaseMeasurement()
+{
+  if (measurement.state == MEASUREMENT_STOPPED)
+  {
+    measurement.state = MEASUREMENT_IDLE;
+  }
+}
+
+void runMessurementFull(unsigned long seconds)
+{
+  writeToDisplay("Running ");
+  writeToDisplay(String(seconds) + " seconds", 1);
+
+  logLine("Measurement starts with " + String(seconds) + "s");
+
+  startMeasurement(seconds, 1);
+}
+
+void runMessurementSplitted(unsigned int seconds)
+{
+  writeToDisplay("Running " + String(seconds) + " seconds");
+
+  logLine("Splitted measurement starts with 10x " + String(seconds) + "s");
+
+  startMeasurement(seconds, 10);
+}
+
+bool runMessurementJob(unsigned long seconds, unsigned long cycles)
+{
+  if (seconds < 1 || seconds > maxJobSeconds || cycles < 1 || cycles > maxJobCycles)
+  {
+    logLine("Usage: job <seconds 1-" + String(maxJobSeconds) + "> <cycles 1-" + String(maxJobCycles) + ">");
+    return false;
+  }
+  if (measurement.state != MEASUREMENT_IDLE)
+  {
+    logLine("Busy");
+    return false;
+  }
+
+  writeToDisplay("Running " + String(cycles) + "x");
+  writeToDisplay(String(seconds) + " seconds", 1);
+
+  logLine("Measurement starts with " + String(cycles) + "x " + String(seconds) + "s");
+
+  startMeasurement(seconds, cycles);
+  return true;
+}
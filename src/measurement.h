@@ -0,0 +1,169 @@
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Pause with the valve closed after every cycle of a measurement with more than one cycle
+const unsigned long measurementPauseMicros = 2000000;
+
+enum MeasurementState
+{
+  MEASUREMENT_IDLE,
+  MEASUREMENT_TARE,
+  MEASUREMENT_GATE,
+  MEASUREMENT_PAUSE,
+  MEASUREMENT_WEIGH,
+  MEASUREMENT_SELFTEST, // the pulse counter is used by the self-test
+  MEASUREMENT_STOPPED   // the emergency stop is engaged, no measurement can start
+};
+
+/**
+ * State of the running measurement, advanced by pollMeasurement().
+ *
+ * After the measurement, pulseCount and weight hold its result.
+ */
+struct Measurement
+{
+  MeasurementState state;
+  unsigned long seconds;
+  unsigned int cycles;
+  unsigned int cycle;
+  uint64_t runStart;
+  uint64_t phaseStart;
+  uint64_t phaseEnd;
+  uint64_t gateTime;
+  unsigned long pulsesAtLastStats;
+  uint64_t statsTime; // when pulsesAtLastStats was sampled during the gate
+  uint64_t volume; // corrected with the linearisation of the active meter, in nanolitres
+  unsigned long pulsesAtCycleStart;
+  unsigned int cyclesDone;       // cycles whose pulses are in the cycle statistics
+  unsigned long cycleMinPulses;
+  unsigned long cycleMaxPulses;
+  unsigned long cyclePulseSum;
+  bool useScale;
+  float tare;
+  unsigned long pulseCount;
+  float weight;
+  bool aborted;
+};
+
+extern Measurement measurement;
+
+// The pulse counter, incremented by countPulse(); outside of interrupt handlers use readPulses()
+extern volatile unsigned long pulses;
+
+/**
+ * Count the pulses from the flow meter
+ * Triggerd by the intterrupt
+ */
+void countPulse();
+
+/**
+ * @brief Reads the pulse counter consistently while the interrupt may update it.
+ *
+ * @return unsigned long The number of pulses counted since the start of the measurement.
+ */
+unsigned long readPulses();
+
+/**
+ * @brief Adds the pulses counted since the last call to the corrected volume of the run.
+ *
+ * @param count The pulse count now.
+ * @param rate The pulse rate the pulses were counted at, in pulses per second.
+ *
+ * @return void
+ */
+void addVolume(unsigned long count, unsigned long rate);
+
+/**
+ * @brief Logs the runtime, the pulse rate since the previous call (or the gate start) and the
+ * volume corrected for the rate as "Time: <s>s Rate: <n>/s Volume: <ml>ml" while a gate is open.
+ *
+ * @return void
+ */
+void logStats();
+
+/**
+ * @brief Starts a measurement of one or more cycles with the valve open for a number of seconds each.
+ *
+ * The measurement runs in the background and is advanced by pollMeasurement(). When more than one
+ * cycle is requested, every cycle is followed by a pause of 2 seconds with the valve closed. If a
+ * scale is connected, the bucket is tared before the first cycle and weighed after the last one.
+ *
+ * @param seconds The number of seconds the valve should be open for each cycle.
+ * @param cycles The number of cycles.
+ *
+ * @return void
+ */
+void startMeasurement(unsigned long seconds, unsigned int cycles);
+
+/**
+ * @brief Advances the running measurement.
+ *
+ * Called on every pass of loop(), so the valve closes at most one task execution after the end of
+ * the gate.
+ *
+ * @return bool True if the measurement finished during this call.
+ */
+bool pollMeasurement();
+
+/**
+ * @brief Aborts the running measurement after an emergency stop and blocks new ones.
+ *
+ * The valve is already closed. The run ends with the pulses counted until the stop, logged as
+ * "Aborted: <count> pulses", and measurement.aborted is set. A running self-test is aborted.
+ *
+ * @param count The pulse count frozen at the stop.
+ *
+ * @return void
+ */
+void abortMeasurement(unsigned long count);
+
+/**
+ * @brief Allows measurements again after the emergency stop was released.
+ *
+ * @return void
+ */
+void releaseMeasurement();
+
+/**
+ * @brief Runs a full measurement with the valve open for a specified number of seconds.
+ *
+ * This function measures the flow rate by counting the pulses from a flow meter.
+ * The valve is opened for the specified number of seconds, then closed, and the total number of pulses
+ * is displayed on the LCD.
+ *
+ * @param seconds The number of seconds the valve should be open.
+ *
+ * @return void
+ */
+void runMessurementFull(unsigned long seconds);
+
+/**
+ * @brief Runs a split measurement with the valve open for a specified number of seconds, repeated 10 times.
+ *
+ * This function measures the flow rate by counting the pulses from a flow meter.
+ * The valve is opened for the specified number of seconds, then closed, and this process is repeated 10 times.
+ * The total number of pulses is then displayed on the LCD.
+ *
+ * @param seconds The number of seconds the valve should be open for each cycle.
+ *
+ * @return void
+ */
+void runMessurementSplitted(unsigned int seconds);
+
+/**
+ * @brief Runs a measurement with a profile given at runtime, e.g. planned on the host and sent as a job.
+ *
+ * The measurement is rejected with a log line ("Busy" or the usage) while another measurement runs
+ * or if the profile is out of range.
+ *
+ * @param seconds The number of seconds the valve should be open for each cycle (1-3600).
+ * @param cycles The number of cycles (1-100).
+ *
+ * @return bool True if the measurement was started.
+ */
+bool runMessurementJob(unsigned long seconds, unsigned long cycles);
+
+#endif
@@ -0,0 +1,92 @@
+#include "memory.h"
+
+#include <avr/io.h>
+
+#include "log.h"
+
+// Defines for Memory
+const uint8_t memoryPaint = 0xC5;
+const uint16_t lowMemoryBytes = 256;
+
+// Symbols of the linker script and of malloc()
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+/**
+ * @brief Paints all memory above the static data before the stack is used.
+ *
+ * Runs in .init1, before the C runtime sets up the stack pointer and zeroes r1, so it is written
+ * without a stack and without r1.
+ *
+ * @return void
+ */
+void paintMemory() __attribute__((naked, used, section(".init1")));
+
+void paintMemory()
+{
+  __asm volatile("    ldi r30, lo8(__heap_start)\n"
+                 "    ldi r31, hi8(__heap_start)\n"
+                 "    ldi r24, %0\n"
+                 "    ldi r25, hi8(%1)\n"
+                 "    rjmp 2f\n"
+                 "1:  st Z+, r24\n"
+                 "2:  cpi r30, lo8(%1)\n"
+                 "    cpc r31, r25\n"
+                 "    brlo 1b\n"
+                 "    breq 1b\n"
+                 :
+                 : "i"(memoryPaint), "i"(RAMEND));
+}
+
+MemoryUsage memoryUsage()
+{
+  const uint8_t *heapStart = &__heap_start;
+  const uint8_t *stackPointer = (const uint8_t *)(uintptr_t)SP;
+
+  // the longest run of paint is the memory neither heap nor stack ever reached
+  const uint8_t *bestStart = stackPointer;
+  uint16_t bestLength = 0;
+  const uint8_t *runStart = heapStart;
+  uint16_t runLength = 0;
+  for (const uint8_t *p = heapStart; p < stackPointer; p++)
+  {
+    if (*p != memoryPaint)
+    {
+      runLength = 0;
+      continue;
+    }
+    if (runLength == 0)
+    {
+      runStart = p;
+    }
+    if (++runLength > bestLength)
+    {
+      bestLength = runLength;
+      bestStart = runStart;
+    }
+  }
+
+  const uint8_t *heapEnd = __brkval ? (const uint8_t *)__brkval : heapStart;
+
+  MemoryUsage usage;
+  usage.staticBytes = heapStart - (const uint8_t *)RAMSTART;
+  usage.heapMax = bestStart - heapStart;
+  usage.stackMax = (const uint8_t *)RAMEND - (bestStart + bestLength) + 1;
+  usage.freeMin = bestLength;
+  usage.freeNow = stackPointer > heapEnd ? stackPointer - heapEnd : 0;
+  return usage;
+}
+
+void memoryReport()
+{
+  MemoryUsage usage = memoryUsage();
+
+  logLine("Memory: static=" + String(usage.staticBytes) + "B heap=" + String(usage.heapMax) +
+          "B stack=" + String(usage.stackMax) + "B free=" + String(usage.freeMin) +
+          "B freeNow=" + String(usage.freeNow) + "B");
+
+  if (usage.freeMin < lowMemoryBytes)
+  {
+    logLine("Memory low: heap and stack came within " + String(usage.freeMin) + "B");
+  }
+}
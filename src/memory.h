@@ -0,0 +1,40 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * SRAM use of the firmware in bytes.
+ *
+ * The heap grows up from the end of the static data, the stack down from the end of SRAM. The
+ * high-water marks come from the paint written into the free memory before main() runs.
+ */
+struct MemoryUsage
+{
+  uint16_t staticBytes; // data and bss
+  uint16_t heapMax;     // highest heap use since the reset
+  uint16_t stackMax;    // deepest stack since the reset, interrupts included
+  uint16_t freeMin;     // memory between heap and stack that was never used
+  uint16_t freeNow;     // memory between heap and stack now
+};
+
+/**
+ * @brief Measures the memory use by looking for the paint between heap and stack.
+ *
+ * Scans the free memory once, which takes a few milliseconds; not for the interrupt handlers.
+ *
+ * @return MemoryUsage The use since the reset.
+ */
+MemoryUsage memoryUsage();
+
+/**
+ * @brief Logs the memory use as "Memory: static=<n>B heap=<n>B stack=<n>B free=<n>B freeNow=<n>B".
+ *
+ * Warns with "Memory low" when heap and stack came closer than 256 bytes.
+ *
+ * @return void
+ */
+void memoryReport();
+
+#endif
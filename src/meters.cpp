@@ -0,0 +1,532 @@
+#include "meters.h"
+
+#include <avr/eeprom.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/atomic.h>
+
+#include "clock.h"
+#include "log.h"
+#include "measurement.h"
+
+// Layout of the registry in EEPROM; a different magic or version formats it
+const uint8_t meterRegistryMagic = 0x4D;
+const uint8_t meterRegistryVersion = 1;
+
+struct MeterRegistry
+{
+  uint8_t magic;
+  uint8_t version;
+  uint16_t channels[meterChannels];
+  MeterRecord slots[meterSlots];
+};
+
+static MeterRegistry meterRegistry EEMEM;
+
+// Names of the edges in the command and the list
+const char *const meterEdgeNames[] = {"falling", "rising", "both"};
+
+// The registry in RAM: the ids of the slots and the meters of the channels, so a meter is found
+// without reading the EEPROM
+static uint16_t meterIds[meterSlots];
+static uint16_t meterChannelIds[meterChannels];
+static uint8_t meterPin = 0xFF;
+#ifdef ARDUINO
+static uint8_t meterAttachedEdge = EDGE_FALLING; // as setup() attaches the interrupt
+#endif
+
+// The meter used until metersBegin() loads the registry, and when its record for channel 0 is invalid
+static const MeterRecord meterDefault = {201, "YF-S201", 0, METER_YFS201, EDGE_FALLING, 0};
+
+// The meter of channel 0 and what is derived from it
+static MeterRecord meterActive = meterDefault;
+static uint32_t meterScale = 65536; // on the table, 16 fractional bits
+static uint32_t meterFlatNanolitres = 0;
+static volatile uint32_t meterGlitchTicks = 0;
+static volatile unsigned long meterGlitches = 0;
+static uint32_t meterLastPulse = 0;
+
+/**
+ * @brief Finds the slot of a meter.
+ *
+ * @param id The id of the meter, 0 for a free slot.
+ *
+ * @return int8_t The slot, -1 if there is none.
+ */
+static int8_t meterSlot(uint16_t id)
+{
+  for (uint8_t slot = 0; slot < meterSlots; slot++)
+  {
+    if (meterIds[slot] == id)
+    {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Checks a record, e.g. one read from a corrupt or blank EEPROM cell.
+ *
+ * @param record The meter.
+ *
+ * @return bool True if the table and the edge are known and the K-factor can be used.
+ */
+static bool meterValid(const MeterRecord &record)
+{
+  // 0 uses the table as it is; the range comparisons are false for NaN and reject infinity
+  bool kFactorValid = record.kFactor == 0 ? record.table != METER_FLAT
+                                          : record.kFactor >= meterMinKFactor && record.kFactor <= meterMaxKFactor;
+  return record.id != 0 && record.table <= METER_FLAT && record.edge <= EDGE_BOTH && kFactorValid;
+}
+
+/**
+ * @brief Reads a record of the registry.
+ *
+ * @param slot The slot.
+ * @param record The meter, with a terminated name.
+ *
+ * @return void
+ */
+static void readMeter(uint8_t slot, MeterRecord &record)
+{
+  eeprom_read_block(&record, &meterRegistry.slots[slot], sizeof(record));
+  record.name[meterNameLength - 1] = '\0';
+}
+
+/**
+ * @brief Makes the record of a meter type with a linearisation table.
+ *
+ * @param id The id of the meter.
+ * @param table The meter type.
+ *
+ * @return MeterRecord The meter, counting falling edges without a glitch filter.
+ */
+static MeterRecord factoryMeter(uint16_t id, uint8_t table)
+{
+  MeterRecord record;
+  memset(&record, 0, sizeof(record));
+  record.id = id;
+  strncpy(record.name, meterName(table), meterNameLength - 1);
+  record.table = table;
+  record.edge = EDGE_FALLING;
+  return record;
+}
+
+/**
+ * @brief Writes an empty registry with the meter types of the linearisation tables.
+ *
+ * @return void
+ */
+static void formatRegistry()
+{
+  MeterRecord record;
+  memset(&record, 0, sizeof(record));
+  for (uint8_t slot = 0; slot < meterSlots; slot++)
+  {
+    eeprom_update_block(&record, &meterRegistry.slots[slot], sizeof(record));
+  }
+
+  record = factoryMeter(201, METER_YFS201);
+  eeprom_update_block(&record, &meterRegistry.slots[0], sizeof(record));
+  record = factoryMeter(300, METER_FS300A);
+  eeprom_update_block(&record, &meterRegistry.slots[1], sizeof(record));
+
+  for (uint8_t channel = 0; channel < meterChannels; channel++)
+  {
+    uint16_t id = 201;
+    eeprom_update_block(&id, &meterRegistry.channels[channel], sizeof(id));
+  }
+
+  // last, so an interrupted format is done again
+  eeprom_update_byte(&meterRegistry.version, meterRegistryVersion);
+  eeprom_update_byte(&meterRegistry.magic, meterRegistryMagic);
+}
+
+/**
+ * @brief Attaches the pulse interrupt for an edge, unless it already counts that edge.
+ *
+ * @param edge The MeterEdge.
+ *
+ * @return void
+ */
+static void meterAttach(uint8_t edge)
+{
+#ifdef ARDUINO
+  if (meterPin == 0xFF || edge == meterAttachedEdge)
+  {
+    return;
+  }
+  const int modes[] = {FALLING, RISING, CHANGE};
+  attachInterrupt(digitalPinToInterrupt(meterPin), countPulse, modes[edge]);
+  meterAttachedEdge = edge;
+#else
+  (void)edge;
+#endif
+}
+
+/**
+ * @brief Counts and converts the pulses of channel 0 for a meter.
+ *
+ * @param record The meter.
+ *
+ * @return void
+ */
+static void applyMeter(const MeterRecord &record)
+{
+  meterActive = record;
+
+  if (record.table >= METER_TYPES)
+  {
+    meterFlatNanolitres = (uint32_t)(1e9f / record.kFactor + 0.5f);
+  }
+  else if (record.kFactor > 0)
+  {
+    // the K-factor of the table at high flow, where it is flat
+    float tableKFactor = 1e9f / nanolitresPerPulse(record.table, ULONG_MAX);
+    meterScale = (uint32_t)(65536.0f * tableKFactor / record.kFactor + 0.5f);
+  }
+  else
+  {
+    // the volume of a whole pulse of the table, split over its two edges if both are counted
+    meterScale = record.edge == EDGE_BOTH ? 32768 : 65536;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    meterGlitchTicks = (uint32_t)record.glitchMicros * 2;
+  }
+
+  meterAttach(record.edge);
+}
+
+void metersBegin(uint8_t pin)
+{
+  meterPin = pin;
+
+  if (eeprom_read_byte(&meterRegistry.magic) != meterRegistryMagic ||
+      eeprom_read_byte(&meterRegistry.version) != meterRegistryVersion)
+  {
+    logLine("Meters: formatting the registry");
+    formatRegistry();
+  }
+
+  for (uint8_t slot = 0; slot < meterSlots; slot++)
+  {
+    eeprom_read_block(&meterIds[slot], &meterRegistry.slots[slot].id, sizeof(uint16_t));
+  }
+  for (uint8_t channel = 0; channel < meterChannels; channel++)
+  {
+    eeprom_read_block(&meterChannelIds[channel], &meterRegistry.channels[channel], sizeof(uint16_t));
+  }
+
+  if (!meterAssign(0, meterChannelIds[0]))
+  {
+    logLine("Meters: no valid meter for channel 0, using " + String(meterDefault.name));
+    applyMeter(meterDefault);
+  }
+}
+
+const MeterRecord &activeMeter()
+{
+  return meterActive;
+}
+
+bool meterAssign(uint8_t channel, uint16_t id)
+{
+  int8_t slot = meterSlot(id);
+  if (channel >= meterChannels || id == 0 || slot < 0)
+  {
+    return false;
+  }
+
+  MeterRecord record;
+  readMeter(slot, record);
+  if (!meterValid(record))
+  {
+    return false;
+  }
+
+  meterChannelIds[channel] = id;
+  eeprom_update_block(&id, &meterRegistry.channels[channel], sizeof(id));
+
+  if (channel == 0)
+  {
+    applyMeter(record);
+  }
+  return true;
+}
+
+bool meterSave(const MeterRecord &record)
+{
+  if (!meterValid(record))
+  {
+    return false;
+  }
+
+  int8_t slot = meterSlot(record.id);
+  if (slot < 0)
+  {
+    slot = meterSlot(0);
+  }
+  if (slot < 0)
+  {
+    return false;
+  }
+
+  MeterRecord stored = record;
+  stored.name[meterNameLength - 1] = '\0';
+  eeprom_update_block(&stored, &meterRegistry.slots[slot], sizeof(stored));
+  meterIds[slot] = stored.id;
+
+  if (meterChannelIds[0] == stored.id)
+  {
+    applyMeter(stored);
+  }
+  return true;
+}
+
+bool meterRemove(uint16_t id)
+{
+  int8_t slot = meterSlot(id);
+  if (id == 0 || slot < 0)
+  {
+    return false;
+  }
+  for (uint8_t channel = 0; channel < meterChannels; channel++)
+  {
+    if (meterChannelIds[channel] == id)
+    {
+      return false;
+    }
+  }
+
+  MeterRecord record;
+  memset(&record, 0, sizeof(record));
+  eeprom_update_block(&record, &meterRegistry.slots[slot], sizeof(record));
+  meterIds[slot] = 0;
+  return true;
+}
+
+bool meterAcceptPulse()
+{
+  uint32_t glitchTicks = meterGlitchTicks;
+  if (glitchTicks == 0)
+  {
+    return true;
+  }
+
+  uint32_t now = clockTicks();
+  if (now - meterLastPulse < glitchTicks)
+  {
+    meterGlitches++;
+    return false;
+  }
+  meterLastPulse = now;
+  return true;
+}
+
+void meterCountRaw(bool raw)
+{
+  meterAttach(raw ? (uint8_t)EDGE_FALLING : meterActive.edge);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    meterGlitchTicks = raw ? 0 : (uint32_t)meterActive.glitchMicros * 2;
+  }
+}
+
+unsigned long meterTakeGlitches()
+{
+  unsigned long glitches;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    glitches = meterGlitches;
+    meterGlitches = 0;
+  }
+  return glitches;
+}
+
+uint32_t meterNanolitresPerPulse(unsigned long rate)
+{
+  if (meterActive.table >= METER_TYPES)
+  {
+    return meterFlatNanolitres;
+  }
+  if (meterActive.edge == EDGE_BOTH)
+  {
+    rate /= 2;
+  }
+  return ((uint64_t)nanolitresPerPulse(meterActive.table, rate) * meterScale) >> 16;
+}
+
+/**
+ * @brief Logs a meter as "Meter <id> <name> K=<k> table=<table> edge=<edge> glitch=<us>us".
+ *
+ * @param record The meter.
+ *
+ * @return void
+ */
+static void logMeter(const MeterRecord &record)
+{
+  logLine("Meter " + String(record.id) + " " + record.name + (meterValid(record) ? "" : " (invalid)") + " K=" +
+          (record.kFactor > 0 ? String(record.kFactor, 1) : String("table")) +
+          " table=" + (record.table == METER_FLAT ? "flat" : meterName(record.table)) + " edge=" +
+          meterEdgeNames[record.edge <= EDGE_BOTH ? record.edge : 0] + " glitch=" + String(record.glitchMicros) + "us");
+}
+
+/**
+ * @brief Logs the meters of the registry and of the channels.
+ *
+ * @return void
+ */
+static void listMeters()
+{
+  for (uint8_t slot = 0; slot < meterSlots; slot++)
+  {
+    if (meterIds[slot] == 0)
+    {
+      continue;
+    }
+    MeterRecord record;
+    readMeter(slot, record);
+    logMeter(record);
+  }
+  for (uint8_t channel = 0; channel < meterChannels; channel++)
+  {
+    logLine("Channel " + String(channel) + ": meter " + String(meterChannelIds[channel]) +
+            (channel == 0 ? String(" ") + meterActive.name : String("")));
+  }
+}
+
+/**
+ * @brief Parses a decimal number that fills the whole text.
+ *
+ * @param text The text, may be null.
+ * @param value The number.
+ *
+ * @return bool True if the text is a number.
+ */
+static bool parseUnsigned(const char *text, unsigned long &value)
+{
+  if (!text || !*text)
+  {
+    return false;
+  }
+  char *end;
+  value = strtoul(text, &end, 10);
+  return *end == '\0';
+}
+
+/**
+ * @brief Parses the fields of "meter set" into a record.
+ *
+ * @param fields The fields after "set", split by strtok_r.
+ * @param record The meter.
+ *
+ * @return bool True if all fields are valid.
+ */
+static bool parseMeter(char *fields, MeterRecord &record)
+{
+  char *save;
+  const char *id = strtok_r(fields, " ", &save);
+  const char *name = strtok_r(NULL, " ", &save);
+  const char *kFactor = strtok_r(NULL, " ", &save);
+  const char *table = strtok_r(NULL, " ", &save);
+  const char *edge = strtok_r(NULL, " ", &save);
+  const char *glitch = strtok_r(NULL, " ", &save);
+
+  unsigned long idValue, glitchValue;
+  if (!parseUnsigned(id, idValue) || !name || !kFactor || !table || !edge || !parseUnsigned(glitch, glitchValue) ||
+      idValue == 0 || idValue > 0xFFFF || glitchValue > 0xFFFF)
+  {
+    return false;
+  }
+
+  memset(&record, 0, sizeof(record));
+  record.id = idValue;
+  strncpy(record.name, name, meterNameLength - 1);
+  record.glitchMicros = glitchValue;
+
+  char *end;
+  record.kFactor = strtod(kFactor, &end);
+  if (*end != '\0')
+  {
+    return false;
+  }
+
+  record.table = 0xFF;
+  for (uint8_t type = 0; type <= METER_FLAT; type++)
+  {
+    if (strcmp(table, type == METER_FLAT ? "flat" : meterName(type)) == 0)
+    {
+      record.table = type;
+    }
+  }
+  record.edge = 0xFF;
+  for (uint8_t mode = EDGE_FALLING; mode <= EDGE_BOTH; mode++)
+  {
+    if (strcmp(edge, meterEdgeNames[mode]) == 0)
+    {
+      record.edge = mode;
+    }
+  }
+  return record.table != 0xFF && record.edge != 0xFF;
+}
+
+void meterCommand(const char *args)
+{
+  char buffer[64];
+  strncpy(buffer, args, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+
+  char *save;
+  const char *verb = strtok_r(buffer, " ", &save);
+  if (!verb || strcmp(verb, "list") == 0)
+  {
+    listMeters();
+    return;
+  }
+  if (measurement.state != MEASUREMENT_IDLE)
+  {
+    logLine("Busy");
+    return;
+  }
+
+  unsigned long id, channel = 0;
+  if (strcmp(verb, "use") == 0)
+  {
+    const char *idText = strtok_r(NULL, " ", &save);
+    const char *channelText = strtok_r(NULL, " ", &save);
+    if (!parseUnsigned(idText, id) || (channelText && !parseUnsigned(channelText, channel)) || id > 0xFFFF ||
+        channel >= meterChannels || !meterAssign(channel, id))
+    {
+      logLine("Usage: meter use <id> [channel], with a meter of the list");
+      return;
+    }
+    logLine("Channel " + String(channel) + ": meter " + String(id) + " " + meterActive.name);
+  }
+  else if (strcmp(verb, "set") == 0)
+  {
+    MeterRecord record;
+    if (!parseMeter(save, record) || !meterSave(record))
+    {
+      logLine("Usage: meter set <id> <name> <k-factor> <table|flat> <falling|rising|both> <glitch-us>");
+      return;
+    }
+    logMeter(record);
+  }
+  else if (strcmp(verb, "del") == 0)
+  {
+    if (!parseUnsigned(strtok_r(NULL, " ", &save), id) || id > 0xFFFF || !meterRemove(id))
+    {
+      logLine("Usage: meter del <id>, of a meter not in use");
+      return;
+    }
+    logLine("Meter " + String(id) + " removed");
+  }
+  else
+  {
+    logLine("Usage: meter [list|use|set|del]");
+  }
+}
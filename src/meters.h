@@ -0,0 +1,152 @@
+#ifndef METERS_H
+#define METERS_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#include "linearisation.h"
+
+// Pulse edges counted by the input, the K-factor counts the same edges
+enum MeterEdge
+{
+  EDGE_FALLING,
+  EDGE_RISING,
+  EDGE_BOTH
+};
+
+// Linearisation of a meter without a table: the constant K-factor
+const uint8_t METER_FLAT = METER_TYPES;
+
+// Defines for Meters: slots of the registry in EEPROM and pulse inputs of the board
+const uint8_t meterSlots = 8;
+const uint8_t meterChannels = 1;
+const uint8_t meterNameLength = 10;
+
+// K-factors a meter may have, in pulses per litre, so the volume per pulse and the table scale
+// fit into 32 bits
+const float meterMinKFactor = 1;
+const float meterMaxKFactor = 100000;
+
+/**
+ * A meter of the registry.
+ */
+struct MeterRecord
+{
+  uint16_t id;                 // 0 for a free slot
+  char name[meterNameLength];  // zero-terminated
+  float kFactor;               // counted edges per litre at high flow; 0 to use the table as it is
+  uint8_t table;               // MeterType of the linearisation table, or METER_FLAT
+  uint8_t edge;                // MeterEdge
+  uint16_t glitchMicros;       // a pulse this soon after the previous one is rejected, 0 for none
+};
+
+/**
+ * @brief Loads the meter registry from EEPROM and switches to the meter of channel 0.
+ *
+ * setup() attaches the pulse interrupt for falling edges before, so pulses are counted from the
+ * reset on; the interrupt is only attached again if the meter counts other edges.
+ *
+ * A blank registry, or one of an older layout, is formatted with the meter types of the
+ * linearisation tables (ids 201 and 300), and channel 0 gets the first one. If the record of
+ * channel 0 is invalid, e.g. after a corrupted write, the built-in YF-S201 meter is used.
+ *
+ * @param pin The pulse input of channel 0, with the interrupt attached for falling edges.
+ *
+ * @return void
+ */
+void metersBegin(uint8_t pin);
+
+/**
+ * @brief Returns the meter the pulses of channel 0 are counted and converted for.
+ *
+ * @return const MeterRecord& The meter.
+ */
+const MeterRecord &activeMeter();
+
+/**
+ * @brief Switches a channel to a meter of the registry.
+ *
+ * Takes the same time for every meter: one record is read from EEPROM, the interrupt is attached
+ * for its edges and the scale of its table is computed. The assignment is stored, so it survives
+ * a reset.
+ *
+ * @param channel The channel.
+ * @param id The id of the meter.
+ *
+ * @return bool False if the channel or the meter is unknown, or its record is invalid.
+ */
+bool meterAssign(uint8_t channel, uint16_t id);
+
+/**
+ * @brief Adds a meter to the registry, or replaces the meter with the same id.
+ *
+ * A meter assigned to a channel is switched to the new values at once.
+ *
+ * @param record The meter, with an id above 0.
+ *
+ * @return bool False if the registry is full or the record is invalid.
+ */
+bool meterSave(const MeterRecord &record);
+
+/**
+ * @brief Removes a meter from the registry, unless it is assigned to a channel.
+ *
+ * @param id The id of the meter.
+ *
+ * @return bool False if the meter is unknown or in use.
+ */
+bool meterRemove(uint16_t id);
+
+/**
+ * @brief Checks a pulse against the glitch filter of the active meter. Called by the pulse interrupt.
+ *
+ * @return bool True if the pulse counts.
+ */
+bool meterAcceptPulse();
+
+/**
+ * @brief Counts every falling edge without the glitch filter, whatever the active meter counts,
+ * e.g. while the self-test generates pulses whose number it knows.
+ *
+ * @param raw True to count raw falling edges, false to return to the edges of the active meter.
+ *
+ * @return void
+ */
+void meterCountRaw(bool raw);
+
+/**
+ * @brief Returns and clears the number of pulses rejected by the glitch filter.
+ *
+ * @return unsigned long The rejected pulses since the last call.
+ */
+unsigned long meterTakeGlitches();
+
+/**
+ * @brief Returns the volume of one pulse of the active meter at a pulse rate.
+ *
+ * The linearisation table of the meter is scaled to its K-factor; a meter without a table has
+ * the same volume at every rate. The tables are over the rate of whole pulses, so for a meter
+ * counting both edges the rate is halved before the lookup, and without a K-factor every edge is
+ * half of the volume of the table.
+ *
+ * @param rate The rate of counted edges per second.
+ *
+ * @return uint32_t The volume per counted edge in nanolitres.
+ */
+uint32_t meterNanolitresPerPulse(unsigned long rate);
+
+/**
+ * @brief Command "meter [list|use <id> [channel]|set <id> <name> <k-factor> <table> <edge> <glitch-us>|del <id>]".
+ *
+ * list (or no argument) logs every meter as "Meter <id> <name> K=<k> table=<table> edge=<edge>
+ * glitch=<us>us" and the channels as "Channel <n>: meter <id> <name>". The table is a name of
+ * meterName() or "flat", the edge "falling", "rising" or "both". use, set and del are rejected
+ * with "Busy" while a measurement runs, as writing the EEPROM takes a few milliseconds per byte.
+ *
+ * @param args The subcommand and its arguments.
+ *
+ * @return void
+ */
+void meterCommand(const char *args);
+
+#endif
@@ -0,0 +1,179 @@
+#include "scale.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include "clock.h"
+
+// Defines for the settle detection
+const float scaleTolerance = 0.5;
+const uint32_t scaleSettleTime = 1000000;
+const uint32_t scalePresentTime = 2000000;
+const uint32_t scaleRequestPeriod = 200000;
+
+// Command that makes the scale send one reading (A&D, Kern and Ohaus compatible)
+const char scaleRequestCommand[] = "Q\r\n";
+
+static HardwareSerial *scalePort = 0;
+static bool scaleOnRequest = false;
+
+static char scaleLine[32];
+static uint8_t scaleLineLength = 0;
+
+static float scaleReading = 0;
+static bool scaleUnstable = true;
+static float scaleReference = 0;
+static uint64_t scaleReceived = 0;
+static uint64_t scaleStableSince = 0;
+static uint64_t scaleLastRequest = 0;
+static bool scaleHasReading = false;
+
+bool scaleParseLine(const char *line, float &grams, bool &unstable)
+{
+  unstable = false;
+
+  // two-letter headers separated by commas
+  while (isalpha(line[0]) && isalpha(line[1]) && line[2] == ',')
+  {
+    if (line[0] == 'O' && line[1] == 'L')
+    {
+      return false;
+    }
+    if (line[0] == 'U' && line[1] == 'S')
+    {
+      unstable = true;
+    }
+    line += 3;
+  }
+
+  while (*line == ' ')
+  {
+    line++;
+  }
+
+  bool negative = false;
+  if (*line == '+' || *line == '-')
+  {
+    negative = *line == '-';
+    line++;
+    while (*line == ' ')
+    {
+      line++;
+    }
+  }
+
+  if (!isdigit(*line) && *line != '.')
+  {
+    return false;
+  }
+
+  float value = 0;
+  while (isdigit(*line))
+  {
+    value = value * 10 + (*line++ - '0');
+  }
+  if (*line == '.')
+  {
+    line++;
+    float scale = 0.1;
+    while (isdigit(*line))
+    {
+      value += (*line++ - '0') * scale;
+      scale /= 10;
+    }
+  }
+
+  while (*line == ' ')
+  {
+    line++;
+  }
+
+  if (line[0] == 'k' && line[1] == 'g')
+  {
+    value *= 1000;
+  }
+  else if (line[0] != 'g' && line[0] != '\0')
+  {
+    return false;
+  }
+
+  grams = negative ? -value : value;
+  return true;
+}
+
+void scaleBegin(HardwareSerial &port, unsigned long baud, bool onRequest)
+{
+  scalePort = &port;
+  scaleOnRequest = onRequest;
+  scalePort->begin(baud);
+}
+
+/**
+ * Takes a new reading into the settle detection.
+ */
+static void scaleUpdate(float grams, bool unstable, uint64_t now)
+{
+  if (!scaleHasReading || fabs(grams - scaleReference) > scaleTolerance)
+  {
+    scaleReference = grams;
+    scaleStableSince = now;
+  }
+
+  scaleReading = grams;
+  scaleUnstable = unstable;
+  scaleReceived = now;
+  scaleHasReading = true;
+}
+
+void scalePoll()
+{
+  if (!scalePort)
+  {
+    return;
+  }
+
+  uint64_t now = clockMicros();
+
+  while (scalePort->available() > 0)
+  {
+    char c = scalePort->read();
+
+    if (c == '\r' || c == '\n')
+    {
+      scaleLine[scaleLineLength] = '\0';
+
+      float grams;
+      bool unstable;
+      if (scaleLineLength > 0 && scaleParseLine(scaleLine, grams, unstable))
+      {
+        scaleUpdate(grams, unstable, now);
+      }
+      scaleLineLength = 0;
+    }
+    else if (scaleLineLength < sizeof(scaleLine) - 1)
+    {
+      scaleLine[scaleLineLength++] = c;
+    }
+  }
+
+  if (scaleOnRequest && now - scaleLastRequest >= scaleRequestPeriod)
+  {
+    scalePort->print(scaleRequestCommand);
+    scaleLastRequest = now;
+  }
+}
+
+bool scalePresent()
+{
+  return scaleHasReading && clockMicros() - scaleReceived < scalePresentTime;
+}
+
+bool scaleSettled()
+{
+  return scalePresent() && !scaleUnstable && clockMicros() - scaleStableSince >= scaleSettleTime;
+}
+
+float scaleWeight()
+{
+  return scaleReading;
+}
@@ -0,0 +1,66 @@
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * @brief Starts reading a serial scale.
+ *
+ * The scale either streams its readings continuously or answers a request command, which is sent
+ * by scalePoll() in on-request mode.
+ *
+ * @param port The serial port the scale is connected to.
+ * @param baud The baud rate of the scale.
+ * @param onRequest True if the scale only sends a reading on request.
+ *
+ * @return void
+ */
+void scaleBegin(HardwareSerial &port, unsigned long baud, bool onRequest);
+
+/**
+ * @brief Reads and parses the received lines and requests the next reading in on-request mode.
+ *
+ * @return void
+ */
+void scalePoll();
+
+/**
+ * @brief Checks whether the scale has sent a valid reading recently.
+ *
+ * @return bool True if a reading arrived within the last 2 seconds.
+ */
+bool scalePresent();
+
+/**
+ * @brief Checks whether the reading has settled.
+ *
+ * The reading is settled when it stayed within the tolerance for the settle time and the scale
+ * did not flag it as unstable.
+ *
+ * @return bool True if the reading is settled.
+ */
+bool scaleSettled();
+
+/**
+ * @brief Returns the last reading of the scale.
+ *
+ * @return float The weight in grams.
+ */
+float scaleWeight();
+
+/**
+ * @brief Parses a line of scale output such as "ST,GS,+0001.234 kg" or "US,+  12.5 g".
+ *
+ * The optional two-letter headers are the stability flag and the weight type. The unit may be g
+ * or kg; a missing unit is read as grams.
+ *
+ * @param line The line without line ending.
+ * @param grams The parsed weight in grams.
+ * @param unstable Set if the scale flags the reading as unstable.
+ *
+ * @return bool False if the line holds no weight or the scale reports an overload.
+ */
+bool scaleParseLine(const char *line, float &grams, bool &unstable);
+
+#endif
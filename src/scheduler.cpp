@@ -0,0 +1,107 @@
+#include "scheduler.h"
+
+#include "clock.h"
+#include "log.h"
+
+// Start of the window the CPU load is computed over
+static uint64_t loadWindowStart = 0;
+static uint64_t loadWindowBusy = 0;
+
+void schedulerBegin()
+{
+  uint64_t now = clockMicros();
+
+  for (uint8_t i = 0; i < taskCount; i++)
+  {
+    taskStats[i] = TaskStats();
+    taskStats[i].release = now;
+  }
+
+  loadWindowStart = now;
+  loadWindowBusy = 0;
+}
+
+void schedulerDispatch()
+{
+  uint64_t now = clockMicros();
+  int8_t next = -1;
+  uint64_t nextDeadline = 0;
+
+  // earliest deadline first among the released tasks
+  for (uint8_t i = 0; i < taskCount; i++)
+  {
+    if (taskStats[i].release > now)
+    {
+      continue;
+    }
+
+    uint64_t deadline = taskStats[i].release + tasks[i].deadline;
+    if (next < 0 || deadline < nextDeadline)
+    {
+      next = i;
+      nextDeadline = deadline;
+    }
+  }
+
+  if (next < 0)
+  {
+    return;
+  }
+
+  const Task &task = tasks[next];
+  TaskStats &stats = taskStats[next];
+
+  task.run();
+
+  uint64_t finish = clockMicros();
+  uint32_t execution = finish - now;
+  uint32_t response = finish - stats.release;
+
+  stats.runs++;
+  stats.busy += execution;
+  loadWindowBusy += execution;
+  if (execution > stats.maxExecution)
+  {
+    stats.maxExecution = execution;
+  }
+  if (response > stats.maxResponse)
+  {
+    stats.maxResponse = response;
+  }
+  if (finish > nextDeadline)
+  {
+    stats.overruns++;
+  }
+
+  // releases that passed while the task was waiting are lost
+  stats.release += task.period;
+  while (stats.release + task.deadline < finish)
+  {
+    stats.release += task.period;
+    stats.overruns++;
+  }
+}
+
+void schedulerReport()
+{
+  uint64_t now = clockMicros();
+
+  for (uint8_t i = 0; i < taskCount; i++)
+  {
+    const TaskStats &stats = taskStats[i];
+    logLine("Task " + String(tasks[i].name) + ": runs=" + String(stats.runs) +
+            " overruns=" + String(stats.overruns) +
+            " exec=" + String(stats.maxExecution) + "us" +
+            " response=" + String(stats.maxResponse) + "us");
+  }
+
+  uint64_t window = now - loadWindowStart;
+  if (window > 0)
+  {
+    unsigned long permille = (loadWindowBusy * 1000) / window;
+    logLine("CPU load: " + String(permille / 10) + "." + String(permille % 10) + "%");
+  }
+
+  loadWindowStart = now;
+  loadWindowBusy = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * A periodic task of the time-triggered scheduler.
+ *
+ * Tasks are released every period and must finish within the deadline, both counted in
+ * microseconds from the release. They run to completion and must never block.
+ */
+struct Task
+{
+  const char *name;
+  uint32_t period;
+  uint32_t deadline;
+  void (*run)();
+};
+
+/**
+ * Runtime bookkeeping of one task, kept next to the static task table.
+ */
+struct TaskStats
+{
+  uint64_t release;
+  uint32_t runs;
+  uint32_t overruns;
+  uint32_t maxExecution;
+  uint32_t maxResponse;
+  uint64_t busy;
+};
+
+// The task table is defined by the application at compile time
+extern const Task tasks[];
+extern const uint8_t taskCount;
+extern TaskStats taskStats[];
+
+/**
+ * @brief Releases every task of the table for the first time.
+ *
+ * @return void
+ */
+void schedulerBegin();
+
+/**
+ * @brief Runs the released task with the earliest deadline, if any.
+ *
+ * Called on every pass of loop(). At most one task runs per call, so the time between two calls
+ * is bounded by the longest task execution. A task that finishes after its deadline, or whose
+ * releases were missed entirely, counts as an overrun.
+ *
+ * @return void
+ */
+void schedulerDispatch();
+
+/**
+ * @brief Logs runs, overruns, worst execution and response time per task and the CPU load.
+ *
+ * The CPU load is the share of time spent in tasks since the previous report.
+ *
+ * @return void
+ */
+void schedulerReport();
+
+#endif
@@ -0,0 +1,294 @@
+#include "selftest.h"
+
+#include "board.h"
+#include "clock.h"
+#include "estop.h"
+#include "log.h"
+#include "measurement.h"
+#include "meters.h"
+
+// Defines for Self-test
+const unsigned long selfTestRates[] = {100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000};
+const uint8_t selfTestRateCount = sizeof(selfTestRates) / sizeof(selfTestRates[0]);
+const unsigned long maxSelfTestSeconds = 60;
+const unsigned long selfTestSettleMicros = 10000;
+
+enum SelfTestState
+{
+  SELFTEST_IDLE,
+  SELFTEST_GATE,
+  SELFTEST_SETTLE
+};
+
+static SelfTestState selfTestState = SELFTEST_IDLE;
+static unsigned long selfTestSeconds;
+static uint8_t selfTestRate;
+static unsigned long selfTestPassed;
+static unsigned long selfTestGenerated;
+static unsigned long pulsesAtRateStart;
+static uint64_t selfTestPhaseEnd;
+static uint64_t generatorStart;
+
+#ifdef ARDUINO
+
+#include <avr/io.h>
+
+// Defines for Pins
+const int selfTestPin = 6; // OC4A, wired to the flow meter input
+
+static uint16_t generatorPeriod;
+static uint8_t generatorPrescaler;
+
+/**
+ * @brief Starts Timer4 toggling OC4A at twice the given rate.
+ *
+ * OC4A starts high, so every second compare match is a falling edge counted by countPulse().
+ *
+ * @param rate The pulse rate in Hz, 100 to 100000.
+ *
+ * @return void
+ */
+static void startGenerator(unsigned long rate)
+{
+  // two toggles per pulse; slow rates need the prescaler to fit the 16-bit compare register
+  uint32_t period = F_CPU / 2 / rate;
+  uint8_t clockSelect = _BV(CS40);
+  generatorPrescaler = 1;
+  if (period > 65536UL)
+  {
+    period /= 8;
+    clockSelect = _BV(CS41);
+    generatorPrescaler = 8;
+  }
+  generatorPeriod = period;
+
+  digitalWrite(selfTestPin, HIGH);
+  pinMode(selfTestPin, OUTPUT);
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  TCCR4B = 0;
+  TCCR4A = 0;
+  TCNT4 = 0;
+  OCR4A = period - 1;
+  // force OC4A high, then toggle it on every compare match
+  TCCR4A = _BV(COM4A1) | _BV(COM4A0);
+  TCCR4C = _BV(FOC4A);
+  TCCR4A = _BV(COM4A0);
+  TIFR4 = _BV(OCF4A);
+  generatorStart = clockMicros();
+  // CTC mode with OCR4A as top, starts the timer
+  TCCR4B = _BV(WGM42) | clockSelect;
+
+  SREG = oldSREG;
+}
+
+/**
+ * @brief Stops Timer4, releases pin 6 and returns the number of falling edges it generated.
+ *
+ * The timer position tells the edges within the last period exactly; the clock only has to tell
+ * the number of full periods, which it does to well within half a period.
+ *
+ * @return unsigned long The number of falling edges since startGenerator().
+ */
+static unsigned long stopGenerator()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  TCCR4B = 0;
+  uint64_t elapsed = clockMicros() - generatorStart;
+  uint16_t ticks = TCNT4;
+
+  SREG = oldSREG;
+
+  // disconnect OC4A and release the line: the pull-up of the meter input keeps it high, so there
+  // is no edge, and the pin no longer drives against the meter
+  TCCR4A = 0;
+  pinMode(selfTestPin, INPUT);
+
+  int64_t elapsedTicks = elapsed * (F_CPU / 1000000UL) / generatorPrescaler;
+  int64_t periods = (elapsedTicks - ticks + generatorPeriod / 2) / generatorPeriod;
+  uint64_t toggles = (periods > 0 ? periods : 0) + (ticks == generatorPeriod - 1 ? 1 : 0);
+  return (toggles + 1) / 2;
+}
+
+/**
+ * @brief Nothing to do: the pulses reach the input through the wire.
+ *
+ * @return void
+ */
+static void loopBackPulses()
+{
+}
+
+#else
+
+// The native build has no timer: the generator follows the virtual clock and its pulses are
+// looped back to countPulse() in software
+static unsigned long generatorRate;
+static unsigned long generatorPulses;
+
+static unsigned long generatedPulses()
+{
+  return (clockMicros() - generatorStart) * generatorRate / 1000000ULL;
+}
+
+static void startGenerator(unsigned long rate)
+{
+  generatorRate = rate;
+  generatorPulses = 0;
+  generatorStart = clockMicros();
+}
+
+static void loopBackPulses()
+{
+  unsigned long due = generatedPulses();
+  while (generatorPulses < due)
+  {
+    generatorPulses++;
+    countPulse();
+  }
+}
+
+static unsigned long stopGenerator()
+{
+  loopBackPulses();
+  generatorRate = 0;
+  return generatorPulses;
+}
+
+#endif
+
+/**
+ * @brief Starts the gate of the current rate.
+ *
+ * @return void
+ */
+static void startRate()
+{
+  unsigned long rate = selfTestRates[selfTestRate];
+  writeToDisplay(String(rate) + "Hz", 1);
+
+  pulsesAtRateStart = readPulses();
+  startGenerator(rate);
+  selfTestState = SELFTEST_GATE;
+  selfTestPhaseEnd = clockMicros() + selfTestSeconds * 1000000ULL;
+}
+
+/**
+ * @brief Logs the highest error-free rate and releases the pulse counter.
+ *
+ * Measurements stay blocked while the emergency stop is engaged.
+ *
+ * @return void
+ */
+static void finishSelfTest()
+{
+  selfTestState = SELFTEST_IDLE;
+  measurement.state = estopEngaged() ? MEASUREMENT_STOPPED : MEASUREMENT_IDLE;
+  meterCountRaw(false);
+
+  if (selfTestPassed == 0)
+  {
+    logLine("Selftest: failed at " + String(selfTestRates[0]) + "Hz, check the wire from pin 6 to pin 2");
+    writeToDisplay("Selftest failed");
+    writeToDisplay("", 1);
+    return;
+  }
+
+  logLine("Selftest: error-free up to " + String(selfTestPassed) + "Hz" +
+          (selfTestPassed == selfTestRates[selfTestRateCount - 1] ? " (highest rate tested)" : ""));
+  writeToDisplay("Selftest max");
+  writeToDisplay(String(selfTestPassed) + "Hz", 1);
+}
+
+bool startSelfTest(unsigned long seconds)
+{
+  if (seconds < 1 || seconds > maxSelfTestSeconds)
+  {
+    logLine("Usage: selftest [seconds 1-" + String(maxSelfTestSeconds) + "]");
+    return false;
+  }
+  if (measurement.state != MEASUREMENT_IDLE)
+  {
+    logLine("Busy");
+    return false;
+  }
+
+  // the generated pulses are counted by their falling edges, whatever the meter counts
+  measurement.state = MEASUREMENT_SELFTEST;
+  meterCountRaw(true);
+  selfTestSeconds = seconds;
+  selfTestRate = 0;
+  selfTestPassed = 0;
+
+  logLine("Selftest starts with " + String(seconds) + "s per rate");
+  writeToDisplay("Selftest");
+  startRate();
+  return true;
+}
+
+void abortSelfTest()
+{
+  if (selfTestState == SELFTEST_IDLE)
+  {
+    return;
+  }
+  if (selfTestState == SELFTEST_GATE)
+  {
+    stopGenerator();
+  }
+  selfTestState = SELFTEST_IDLE;
+  meterCountRaw(false);
+
+  logLine("Selftest: aborted");
+  writeToDisplay("Selftest aborted");
+  writeToDisplay("", 1);
+}
+
+bool pollSelfTest()
+{
+  if (selfTestState == SELFTEST_IDLE)
+  {
+    return false;
+  }
+
+  loopBackPulses();
+  uint64_t now = clockMicros();
+  if (now < selfTestPhaseEnd)
+  {
+    return false;
+  }
+
+  if (selfTestState == SELFTEST_GATE)
+  {
+    // let the last edges reach the counter before comparing
+    selfTestGenerated = stopGenerator();
+    selfTestState = SELFTEST_SETTLE;
+    selfTestPhaseEnd = now + selfTestSettleMicros;
+    return false;
+  }
+
+  unsigned long rate = selfTestRates[selfTestRate];
+  unsigned long counted = readPulses() - pulsesAtRateStart;
+  bool errorFree = counted == selfTestGenerated;
+  logLine("Selftest " + String(rate) + "Hz: " + String(counted) + " of " + String(selfTestGenerated) + " pulses" +
+          (errorFree ? "" : ", failed"));
+
+  if (!errorFree)
+  {
+    finishSelfTest();
+    return true;
+  }
+
+  selfTestPassed = rate;
+  if (++selfTestRate == selfTestRateCount)
+  {
+    finishSelfTest();
+    return true;
+  }
+  startRate();
+  return false;
+}
@@ -0,0 +1,40 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * @brief Starts the self-test of the pulse input.
+ *
+ * Timer4 generates pulse trains of increasing rate (100 Hz to 100 kHz) on its OC4A pin (pin 6),
+ * which is wired back to the flow meter input (pin 2). Every rate runs for a gate of the given
+ * seconds with the valve closed, and the pulses counted by countPulse() are compared with the
+ * generated ones. The test stops at the first rate with a difference and logs the highest
+ * error-free rate. Pin 6 only drives the line while a rate runs; otherwise it is an input, so it
+ * does not work against the meter on the same wire.
+ *
+ * While the test runs, measurement.state is MEASUREMENT_SELFTEST, so measurements are rejected.
+ *
+ * @param seconds The gate time per rate in seconds (1-60).
+ *
+ * @return bool True if the test was started.
+ */
+bool startSelfTest(unsigned long seconds);
+
+/**
+ * @brief Aborts the running self-test after an emergency stop: stops the generator and logs
+ * "Selftest: aborted". Does nothing if no self-test runs.
+ *
+ * @return void
+ */
+void abortSelfTest();
+
+/**
+ * @brief Advances the running self-test.
+ *
+ * @return bool True if the self-test finished during this call.
+ */
+bool pollSelfTest();
+
+#endif
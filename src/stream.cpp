@@ -0,0 +1,203 @@
+#include "stream.h"
+
+#include <util/atomic.h>
+
+#include "clock.h"
+#include "log.h"
+
+/**
+ * A frame of pulses: the length byte, the pulse count, the time of the first pulse and the
+ * varints of the intervals, as they are sent.
+ */
+struct StreamFrame
+{
+  uint8_t data[streamFrameSize];
+  uint8_t length;
+  volatile bool ready;
+};
+
+// Offset of the varints in a frame, and the longest varint of a 32-bit value
+const uint8_t streamHeaderLength = 6;
+const uint8_t streamVarintLength = 5;
+
+// Two frames: the pulse interrupt fills one while the other waits to be sent
+static StreamFrame streamFrames[2];
+static volatile uint8_t streamFilling = 0;
+static volatile bool streamEnabled = false;
+static volatile uint16_t streamLost = 0;
+static uint32_t streamPrevious = 0;
+static uint32_t streamInterval = 0;
+
+/**
+ * @brief Empties a frame for the first pulse.
+ *
+ * @param frame The frame.
+ *
+ * @return void
+ */
+static void streamReset(StreamFrame &frame)
+{
+  frame.data[1] = 0;
+  frame.length = streamHeaderLength;
+  frame.ready = false;
+}
+
+/**
+ * @brief Switches to the other frame if it has been sent. Called with interrupts disabled.
+ *
+ * @return void
+ */
+static void streamSwap()
+{
+  uint8_t other = streamFilling ^ 1;
+  if (!streamFrames[other].ready)
+  {
+    streamReset(streamFrames[other]);
+    streamFilling = other;
+  }
+}
+
+/**
+ * @brief Marks the frame being filled as ready to be sent. Called with interrupts disabled.
+ *
+ * @return void
+ */
+static void streamClose()
+{
+  StreamFrame &frame = streamFrames[streamFilling];
+  frame.data[0] = frame.length - 1;
+  frame.ready = true;
+  streamSwap();
+}
+
+/**
+ * @brief Computes the CRC-8 of a frame, polynomial 0x07.
+ *
+ * @param data The bytes.
+ * @param length The number of bytes.
+ *
+ * @return uint8_t The checksum.
+ */
+static uint8_t streamCrc(const uint8_t *data, uint8_t length)
+{
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+void streamEnable(bool enable)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (enable && !streamEnabled && !streamFrames[streamFilling].ready)
+    {
+      streamReset(streamFrames[streamFilling]);
+    }
+    else if (!enable && streamEnabled && streamFrames[streamFilling].data[1] > 0 && !streamFrames[streamFilling].ready)
+    {
+      streamClose();
+    }
+    streamEnabled = enable;
+  }
+}
+
+bool streamPulse()
+{
+  if (!streamEnabled)
+  {
+    return false;
+  }
+
+  StreamFrame &frame = streamFrames[streamFilling];
+  if (frame.ready)
+  {
+    streamLost++;
+    return true;
+  }
+
+  uint32_t now = (uint32_t)clockMicros();
+  uint8_t count = frame.data[1];
+  if (count == 0)
+  {
+    frame.data[2] = now;
+    frame.data[3] = now >> 8;
+    frame.data[4] = now >> 16;
+    frame.data[5] = now >> 24;
+  }
+  else
+  {
+    // the first interval of a frame as it is, the following ones as zigzag encoded differences
+    uint32_t interval = now - streamPrevious;
+    int32_t difference = (int32_t)(interval - streamInterval);
+    uint32_t code = count == 1 ? interval : ((uint32_t)difference << 1) ^ (uint32_t)(difference >> 31);
+    streamInterval = interval;
+
+    while (code >= 0x80)
+    {
+      frame.data[frame.length++] = (code & 0x7F) | 0x80;
+      code >>= 7;
+    }
+    frame.data[frame.length++] = code;
+  }
+  streamPrevious = now;
+  frame.data[1] = count + 1;
+
+  if (frame.data[1] == 0xFF || frame.length > streamFrameSize - streamVarintLength)
+  {
+    streamClose();
+  }
+  return true;
+}
+
+void streamFlush()
+{
+  uint16_t lost;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    lost = streamLost;
+    streamLost = 0;
+
+    // a slow flow still sends its pulses within streamFrameMicros
+    StreamFrame &filling = streamFrames[streamFilling];
+    uint32_t start = (uint32_t)filling.data[2] | (uint32_t)filling.data[3] << 8 | (uint32_t)filling.data[4] << 16 |
+                     (uint32_t)filling.data[5] << 24;
+    if (!filling.ready && filling.data[1] > 0 && !streamFrames[streamFilling ^ 1].ready &&
+        (uint32_t)clockMicros() - start >= streamFrameMicros)
+    {
+      streamClose();
+    }
+  }
+  if (lost > 0)
+  {
+    logLine("Stream lost: " + String(lost));
+  }
+
+  // while this frame is ready the pulse interrupt does not switch to it
+  StreamFrame &frame = streamFrames[streamFilling ^ 1];
+  if (!frame.ready || logSpace() < (unsigned int)frame.length + 2)
+  {
+    return;
+  }
+
+  uint8_t crc = streamCrc(frame.data, frame.length);
+  // one block for logLineFirst(): a line after the marker would be read as the frame length
+  logBytes(&streamFrameMarker, 1, false);
+  logBytes(frame.data, frame.length, false);
+  logBytes(&crc, 1);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    frame.ready = false;
+    if (streamFrames[streamFilling].ready)
+    {
+      streamSwap();
+    }
+  }
+}
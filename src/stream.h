@@ -0,0 +1,49 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Defines for Stream: frames are closed when full or when their first pulse is this old
+const uint8_t streamFrameSize = 72;
+const unsigned long streamFrameMicros = 100000;
+
+// First byte of a frame; it never starts a text line
+const uint8_t streamFrameMarker = 0x00;
+
+/**
+ * @brief Starts or stops streaming pulses in compressed frames instead of trace lines.
+ *
+ * Stopping closes the frame being filled, so its pulses are still sent.
+ *
+ * @param enable True to start streaming.
+ *
+ * @return void
+ */
+void streamEnable(bool enable);
+
+/**
+ * @brief Adds a pulse with the current time to the frame being filled. Called by the pulse interrupt.
+ *
+ * The interval to the previous pulse is stored as the varint of its difference to the previous
+ * interval, so a steady flow takes one byte per pulse. Pulses that arrive while both frames wait
+ * to be sent are counted as lost.
+ *
+ * @return bool True if streaming is enabled and the pulse is not to be traced.
+ */
+bool streamPulse();
+
+/**
+ * @brief Sends a closed frame while the log has room for it and closes an old frame.
+ *
+ * A frame is sent between two lines as the marker byte 0x00, the length L of the rest without
+ * the checksum, the number of pulses, the time of the first pulse (low 32 bits of the clock in
+ * microseconds, little endian), the LEB128 varints of the first interval and of the zigzag
+ * encoded differences of the following intervals, and a CRC-8 (polynomial 0x07) over L and the
+ * L bytes after it. Lost pulses are reported as "Stream lost: <count>".
+ *
+ * @return void
+ */
+void streamFlush();
+
+#endif
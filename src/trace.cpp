@@ -0,0 +1,123 @@
+#include "trace.h"
+
+#include <util/atomic.h>
+
+#include "clock.h"
+#include "log.h"
+
+/**
+ * An event waiting to be sent, with the low 32 bits of its timestamp.
+ */
+struct TraceRecord
+{
+  uint32_t time;
+  uint16_t value;
+  uint8_t extra;
+  char type;
+};
+
+// Size of the event queue, a power of two
+const uint8_t traceQueueSize = 32;
+const uint8_t traceQueueMask = traceQueueSize - 1;
+
+// Space a trace line takes in the log, including the line ending
+const unsigned int traceLineLength = 24;
+
+// The 32-bit deltas wrap after 71.6 minutes; a quiet trace is rebased well before
+const uint32_t traceResyncMicros = 600000000;
+
+static TraceRecord traceQueue[traceQueueSize];
+static volatile uint8_t traceHead = 0;
+static volatile uint8_t traceTail = 0;
+static volatile bool traceEnabled = false;
+static volatile uint16_t traceLost = 0;
+static uint32_t tracePrevious = 0;
+
+void traceEnable(bool enable)
+{
+  if (enable && !traceEnabled)
+  {
+    uint64_t now = clockMicros();
+    tracePrevious = (uint32_t)now;
+    logLine("Trace: " + microsToString(now));
+  }
+
+  traceEnabled = enable;
+}
+
+void traceEvent(char type, uint16_t value, uint8_t extra)
+{
+  if (!traceEnabled)
+  {
+    return;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uint8_t head = traceHead;
+    if (((head + 1) & traceQueueMask) == traceTail)
+    {
+      traceLost++;
+    }
+    else
+    {
+      TraceRecord &record = traceQueue[head];
+      record.time = (uint32_t)clockMicros();
+      record.value = value;
+      record.extra = extra;
+      record.type = type;
+      traceHead = (head + 1) & traceQueueMask;
+    }
+  }
+}
+
+void traceFlush()
+{
+  uint16_t lost;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    lost = traceLost;
+    traceLost = 0;
+  }
+  if (lost > 0)
+  {
+    logLine("Trace lost: " + String(lost));
+  }
+
+  while (traceTail != traceHead && logSpace() >= traceLineLength)
+  {
+    TraceRecord record = traceQueue[traceTail];
+    traceTail = (traceTail + 1) & traceQueueMask;
+
+    String line = String("T") + record.type + " " + String(record.time - tracePrevious);
+    tracePrevious = record.time;
+
+    if (record.type == TRACE_VALVE || record.type == TRACE_BUTTON)
+    {
+      line += " " + String(record.value);
+    }
+    else if (record.type == TRACE_START)
+    {
+      line += " " + String(record.value) + " " + String(record.extra);
+    }
+
+    logLine(line);
+  }
+
+  // a new base while the queue is empty, so no queued event is older than it
+  bool resync = false;
+  uint64_t now = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    now = clockMicros();
+    if (traceEnabled && traceTail == traceHead && (uint32_t)now - tracePrevious >= traceResyncMicros)
+    {
+      tracePrevious = (uint32_t)now;
+      resync = true;
+    }
+  }
+  if (resync)
+  {
+    logLine("Trace: " + microsToString(now));
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Types of trace events, sent as the second letter of a trace line
+const char TRACE_PULSE = 'P';
+const char TRACE_VALVE = 'V';
+const char TRACE_BUTTON = 'B';
+const char TRACE_START = 'S';
+const char TRACE_FINISH = 'F';
+
+/**
+ * @brief Starts or stops recording events.
+ *
+ * Starting logs "Trace: <micros>", the absolute time the first event is counted from.
+ *
+ * @param enable True to start recording.
+ *
+ * @return void
+ */
+void traceEnable(bool enable);
+
+/**
+ * @brief Records an event with the current time while tracing is enabled.
+ *
+ * Safe to call from interrupt handlers. Events that do not fit into the queue are counted as lost.
+ *
+ * @param type The type of the event.
+ * @param value The first value of the event, e.g. the valve state or the button pin.
+ * @param extra The second value of the event.
+ *
+ * @return void
+ */
+void traceEvent(char type, uint16_t value = 0, uint8_t extra = 0);
+
+/**
+ * @brief Sends queued events as trace lines while the log has room for them.
+ *
+ * A line is "T<type> <delta>[ <value>[ <extra>]]", with the time in microseconds since the
+ * previous event. Lost events are reported as "Trace lost: <count>". After 10 minutes without
+ * events "Trace: <micros>" is logged again and the next delta counts from it, so the 32-bit
+ * deltas never wrap.
+ *
+ * @return void
+ */
+void traceFlush();
+
+#endif
@@ -0,0 +1,144 @@
+#include "twi.h"
+
+#include <avr/interrupt.h>
+
+// TWI status codes of the master transmitter
+const uint8_t twiStart = 0x08;
+const uint8_t twiRepeatedStart = 0x10;
+const uint8_t twiAddressAck = 0x18;
+const uint8_t twiDataAck = 0x28;
+
+// Size of the transmit queue, a power of two
+const uint8_t twiQueueSize = 128;
+const uint8_t twiQueueMask = twiQueueSize - 1;
+
+// Transactions are queued as [address][length][data...]
+static uint8_t twiQueue[twiQueueSize];
+static volatile uint8_t twiHead = 0;
+static volatile uint8_t twiTail = 0;
+static volatile bool twiBusy = false;
+static volatile uint16_t twiErrorCount = 0;
+
+// Bytes left in the transaction on the bus, only used by the interrupt
+static uint8_t twiRemaining = 0;
+
+/**
+ * Starts the next queued transaction with a (repeated) start, or releases the bus.
+ * Called from the interrupt; a stop is forced first after an error.
+ */
+static void twiNext(bool stop)
+{
+  if (twiTail != twiHead)
+  {
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA) | (stop ? _BV(TWSTO) : 0);
+  }
+  else
+  {
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    twiBusy = false;
+  }
+}
+
+ISR(TWI_vect)
+{
+  switch (TWSR & 0xF8)
+  {
+  case twiStart:
+  case twiRepeatedStart:
+    TWDR = twiQueue[twiTail] << 1;
+    twiRemaining = twiQueue[(twiTail + 1) & twiQueueMask];
+    twiTail = (twiTail + 2) & twiQueueMask;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    break;
+
+  case twiAddressAck:
+  case twiDataAck:
+    if (twiRemaining > 0)
+    {
+      TWDR = twiQueue[twiTail];
+      twiTail = (twiTail + 1) & twiQueueMask;
+      twiRemaining--;
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    }
+    else
+    {
+      twiNext(false);
+    }
+    break;
+
+  default:
+    // NACK, lost arbitration or bus error: drop the rest of the transaction
+    twiErrorCount++;
+    twiTail = (twiTail + twiRemaining) & twiQueueMask;
+    twiRemaining = 0;
+    twiNext(true);
+    break;
+  }
+}
+
+void twiBegin(unsigned long frequency)
+{
+  // internal pull-ups, the display module has its own as well
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+
+  TWSR = 0;
+  TWBR = ((F_CPU / frequency) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+uint8_t twiAvailableForWrite()
+{
+  uint8_t used = (twiHead - twiTail) & twiQueueMask;
+  uint8_t free = twiQueueSize - 1 - used;
+  return free > 2 ? free - 2 : 0;
+}
+
+bool twiWrite(uint8_t address, const uint8_t *data, uint8_t length)
+{
+  if (length > twiAvailableForWrite())
+  {
+    return false;
+  }
+
+  uint8_t head = twiHead;
+  twiQueue[head] = address;
+  twiQueue[(head + 1) & twiQueueMask] = length;
+  head = (head + 2) & twiQueueMask;
+
+  for (uint8_t i = 0; i < length; i++)
+  {
+    twiQueue[head] = data[i];
+    head = (head + 1) & twiQueueMask;
+  }
+
+  // publish the transaction to the interrupt in one store
+  twiHead = head;
+
+  twiPoll();
+  return true;
+}
+
+void twiPoll()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  // a stop condition is still on the bus when TWSTO has not cleared yet
+  if (!twiBusy && twiTail != twiHead && !(TWCR & _BV(TWSTO)))
+  {
+    twiBusy = true;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+  }
+
+  SREG = oldSREG;
+}
+
+uint16_t twiErrors()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t errors = twiErrorCount;
+  SREG = oldSREG;
+  return errors;
+}
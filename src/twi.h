@@ -0,0 +1,54 @@
+#ifndef TWI_H
+#define TWI_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * @brief Enables the TWI (I2C) hardware as bus master.
+ *
+ * @param frequency The SCL frequency in Hz, 400000 for Fast-mode.
+ *
+ * @return void
+ */
+void twiBegin(unsigned long frequency);
+
+/**
+ * @brief Queues a write transaction to a device on the bus.
+ *
+ * The bytes are copied into the transmit queue and sent by the TWI interrupt, so the call returns
+ * immediately. Transactions are sent in order, joined by repeated starts.
+ *
+ * @param address The 7-bit address of the device.
+ * @param data The bytes to write.
+ * @param length The number of bytes.
+ *
+ * @return bool False if the queue has no room for the transaction; nothing is queued then.
+ */
+bool twiWrite(uint8_t address, const uint8_t *data, uint8_t length);
+
+/**
+ * @brief Returns the number of data bytes a single transaction may currently take.
+ *
+ * @return uint8_t The free space in the transmit queue.
+ */
+uint8_t twiAvailableForWrite();
+
+/**
+ * @brief Starts the bus if transactions are queued and the previous stop condition has completed.
+ *
+ * twiWrite() starts the bus itself; this is only needed when a transaction was queued while a stop
+ * condition was still being sent.
+ *
+ * @return void
+ */
+void twiPoll();
+
+/**
+ * @brief Returns the number of transactions dropped because of a NACK or a bus error.
+ *
+ * @return uint16_t The error count since twiBegin().
+ */
+uint16_t twiErrors();
+
+#endif
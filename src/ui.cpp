@@ -0,0 +1,224 @@
+#include "ui.h"
+
+#include "clock.h"
+#include "estop.h"
+#include "lcd.h"
+#include "measurement.h"
+#include "meters.h"
+#include "scale.h"
+
+// Defines for UI
+const uint32_t uiRatePeriod = 1000000;
+
+// Names of the measurement states on the progress page
+const char *const uiPhaseNames[] = {"Idle", "Tare", "Gate", "Pause", "Weigh", "Selftest", "Stopped"};
+
+static char uiStatus[lcdRows][lcdColumns + 1];
+static uint8_t uiPage = UI_STATUS;
+static uint8_t uiLine = 0;
+
+static uint64_t uiRateTime = 0;
+static unsigned long uiRateCount = 0;
+static unsigned long uiRate = 0;
+
+void uiSetStatus(uint8_t line, const char *text)
+{
+  if (line >= lcdRows)
+  {
+    return;
+  }
+  strncpy(uiStatus[line], text, lcdColumns);
+  uiStatus[line][lcdColumns] = '\0';
+}
+
+void uiShowPage(uint8_t page)
+{
+  uiPage = page < UI_PAGES ? page : (uint8_t)UI_STATUS;
+  uiLine = 0;
+}
+
+void uiNextPage()
+{
+  uiShowPage((uiPage + 1) % UI_PAGES);
+}
+
+void uiPreviousPage()
+{
+  uiShowPage((uiPage + UI_PAGES - 1) % UI_PAGES);
+}
+
+/**
+ * @brief Samples the pulse rate once per period.
+ *
+ * The counter restarts at 0 with every measurement; the pulses since then count for the period.
+ *
+ * @param now The current time.
+ *
+ * @return void
+ */
+static void sampleRate(uint64_t now)
+{
+  if (now - uiRateTime < uiRatePeriod)
+  {
+    return;
+  }
+
+  unsigned long count = readPulses();
+  unsigned long counted = count >= uiRateCount ? count - uiRateCount : count;
+  uiRate = (uint64_t)counted * 1000000 / (now - uiRateTime);
+  uiRateTime = now;
+  uiRateCount = count;
+}
+
+/**
+ * @brief Renders a line of the live page: pulse rate and flow.
+ *
+ * @param line The line number.
+ *
+ * @return String The text of the line.
+ */
+static String liveLine(uint8_t line)
+{
+  if (line == 0)
+  {
+    return "Rate " + String(uiRate) + "/s";
+  }
+  float litresPerMinute = (float)uiRate * meterNanolitresPerPulse(uiRate) * 60 / 1e9f;
+  return String(litresPerMinute, 2) + " l/min";
+}
+
+/**
+ * @brief Renders a line of the progress page: cycle and phase, then the time remaining.
+ *
+ * @param line The line number.
+ * @param now The current time.
+ *
+ * @return String The text of the line.
+ */
+static String progressLine(uint8_t line, uint64_t now)
+{
+  MeasurementState state = measurement.state;
+  if (state == MEASUREMENT_IDLE || state == MEASUREMENT_SELFTEST || state == MEASUREMENT_STOPPED)
+  {
+    return line == 0 ? String(uiPhaseNames[state]) : String("");
+  }
+  if (line == 0)
+  {
+    return "Cycle " + String(measurement.cycle) + "/" + String(measurement.cycles) + " " + uiPhaseNames[state];
+  }
+  if (state == MEASUREMENT_TARE)
+  {
+    return "Taring";
+  }
+  if (state == MEASUREMENT_WEIGH)
+  {
+    return "Weighing";
+  }
+
+  uint64_t total = (uint64_t)measurement.cycles * measurement.seconds * 1000000ULL;
+  if (measurement.cycles > 1)
+  {
+    total += (uint64_t)measurement.cycles * measurementPauseMicros;
+  }
+  uint64_t elapsed = now - measurement.runStart;
+  uint64_t remaining = total > elapsed ? total - elapsed : 0;
+  unsigned long percent = total > 0 ? (total - remaining) * 100 / total : 100;
+  return "Left " + String((unsigned long)((remaining + 999999) / 1000000)) + "s " + String(percent) + "%";
+}
+
+/**
+ * @brief Renders a line of the result page: pulses, then weight and corrected volume.
+ *
+ * @param line The line number.
+ *
+ * @return String The text of the line.
+ */
+static String resultLine(uint8_t line)
+{
+  if (measurement.state != MEASUREMENT_IDLE && measurement.state != MEASUREMENT_STOPPED)
+  {
+    return line == 0 ? String("Running") : String("");
+  }
+  if (line == 0)
+  {
+    return (measurement.aborted ? "Aborted " : "Pulses ") + String(measurement.pulseCount);
+  }
+
+  String volume = String(measurement.volume / 1000000.0, 1) + "ml";
+  if (measurement.useScale && !measurement.aborted)
+  {
+    return String(measurement.weight, 1) + "g " + volume;
+  }
+  return volume;
+}
+
+/**
+ * @brief Renders a line of the cycle page: cycles and mean pulses, then the range and its spread.
+ *
+ * @param line The line number.
+ *
+ * @return String The text of the line.
+ */
+static String cyclesLine(uint8_t line)
+{
+  unsigned int count = measurement.cyclesDone;
+  if (count == 0)
+  {
+    return line == 0 ? String("No cycles") : String("");
+  }
+
+  unsigned long mean = measurement.cyclePulseSum / count;
+  if (line == 0)
+  {
+    return "n=" + String(count) + " avg " + String(mean);
+  }
+  float spread = mean > 0 ? (measurement.cycleMaxPulses - measurement.cycleMinPulses) * 100.0f / mean : 0;
+  return String(measurement.cycleMinPulses) + "-" + String(measurement.cycleMaxPulses) + " " + String(spread, 1) + "%";
+}
+
+/**
+ * @brief Renders a line of the configuration page: active meter, then scale and emergency stop.
+ *
+ * @param line The line number.
+ *
+ * @return String The text of the line.
+ */
+static String configLine(uint8_t line)
+{
+  if (line == 0)
+  {
+    return String("Meter ") + activeMeter().name;
+  }
+  return String("Scale ") + (scalePresent() ? "yes" : "no") + (estopEngaged() ? " STOP" : "");
+}
+
+void uiPoll()
+{
+  uint64_t now = clockMicros();
+  sampleRate(now);
+
+  uint8_t line = uiLine;
+  uiLine = (uiLine + 1) % lcdRows;
+
+  switch (uiPage)
+  {
+  case UI_STATUS:
+    lcdSetLine(line, uiStatus[line]);
+    break;
+  case UI_LIVE:
+    lcdSetLine(line, liveLine(line).c_str());
+    break;
+  case UI_PROGRESS:
+    lcdSetLine(line, progressLine(line, now).c_str());
+    break;
+  case UI_RESULT:
+    lcdSetLine(line, resultLine(line).c_str());
+    break;
+  case UI_CYCLES:
+    lcdSetLine(line, cyclesLine(line).c_str());
+    break;
+  case UI_CONFIG:
+    lcdSetLine(line, configLine(line).c_str());
+    break;
+  }
+}
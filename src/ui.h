@@ -0,0 +1,64 @@
+#ifndef UI_H
+#define UI_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Pages of the display, in the order the buttons step through them
+enum UiPage
+{
+  UI_STATUS,   // the messages of the measurement and the self-test
+  UI_LIVE,     // pulse rate and flow of the last second
+  UI_PROGRESS, // cycle, phase, time remaining of the running measurement
+  UI_RESULT,   // pulses, weight and volume of the last measurement
+  UI_CYCLES,   // pulses per cycle of the last measurement: count, mean, range
+  UI_CONFIG,   // meter type, scale and emergency stop
+  UI_PAGES
+};
+
+/**
+ * @brief Sets a line of the status page.
+ *
+ * The status page keeps the last message of the measurement, also while another page is shown.
+ *
+ * @param line The line number (0-indexed).
+ * @param text The text, longer text is cut off.
+ *
+ * @return void
+ */
+void uiSetStatus(uint8_t line, const char *text);
+
+/**
+ * @brief Shows a page; it is rendered by the next calls of uiPoll().
+ *
+ * @param page The page, UI_STATUS if out of range.
+ *
+ * @return void
+ */
+void uiShowPage(uint8_t page);
+
+/**
+ * @brief Shows the next page, after the last one the first.
+ *
+ * @return void
+ */
+void uiNextPage();
+
+/**
+ * @brief Shows the previous page, before the first one the last.
+ *
+ * @return void
+ */
+void uiPreviousPage();
+
+/**
+ * @brief Renders one line of the shown page into the frame buffer of the display.
+ *
+ * Only one line is formatted per call and the display sends only lines that changed, so a call
+ * takes a bounded time however much changes. The live values are sampled once per second.
+ *
+ * @return void
+ */
+void uiPoll();
+
+#endif
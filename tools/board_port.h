@@ -0,0 +1,136 @@
+/**
+ * Serial port of a board in an epoll loop of a host tool.
+ *
+ * The port is opened non-blocking and registered with its BoardPort as epoll data. When epoll
+ * reports it readable, drainBoardPort() reads until EAGAIN and decodes the bytes with the board's
+ * own DeviceReader, which takes the pulse frames out before it splits the text into lines.
+ */
+
+#ifndef BOARD_PORT_H
+#define BOARD_PORT_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pulse_stream.h"
+#include "serial_port.h"
+
+const size_t maxLineLength = 256;
+
+struct BoardPort
+{
+  std::string path;
+  uint16_t board = 0;
+  uint16_t channel = 0;
+  int fd = -1;
+  DeviceReader reader;
+  uint64_t bytes = 0;
+  uint64_t reopens = 0;
+
+  BoardPort()
+  {
+    reader.stream.lineLimit = maxLineLength;
+  }
+};
+
+/**
+ * Returns the host time in microseconds since the epoch.
+ */
+inline uint64_t hostMicros()
+{
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Parses PATH[:BOARD[:CHANNEL]]; the board defaults to defaultBoard and the channel to 0.
+ */
+inline bool parseBoardPort(const std::string &spec, uint16_t defaultBoard, BoardPort &port)
+{
+  std::string path = spec;
+  unsigned board = defaultBoard, channel = 0;
+
+  size_t colon = spec.find(':');
+  if (colon != std::string::npos)
+  {
+    path = spec.substr(0, colon);
+    if (std::sscanf(spec.c_str() + colon, ":%u:%u", &board, &channel) < 1)
+    {
+      return false;
+    }
+  }
+  port.path = path;
+  port.board = board;
+  port.channel = channel;
+  return !path.empty();
+}
+
+/**
+ * Opens the port and adds it to the epoll set with context as data, or the port itself.
+ */
+inline bool openBoardPort(int epoll, BoardPort &port, int baud, void *context = nullptr)
+{
+  port.fd = openSerialPort(port.path.c_str(), baud, true);
+  if (port.fd < 0)
+  {
+    return false;
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.ptr = context ? context : &port;
+  if (epoll_ctl(epoll, EPOLL_CTL_ADD, port.fd, &event) != 0)
+  {
+    close(port.fd);
+    port.fd = -1;
+    return false;
+  }
+  return true;
+}
+
+inline void closeBoardPort(int epoll, BoardPort &port)
+{
+  epoll_ctl(epoll, EPOLL_CTL_DEL, port.fd, nullptr);
+  close(port.fd);
+  port.fd = -1;
+  port.reader.stream.clear();
+}
+
+/**
+ * Reads everything the port has and calls handle(time, record, line) for every complete line and
+ * every pulse of a frame, with the host time of the read. Returns false when the port hung up.
+ */
+template <typename Handler>
+bool drainBoardPort(BoardPort &port, Handler handle)
+{
+  char buffer[4096];
+  for (;;)
+  {
+    ssize_t count = read(port.fd, buffer, sizeof(buffer));
+    if (count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count < 0 && errno == EAGAIN)
+    {
+      return true;
+    }
+    if (count <= 0)
+    {
+      return false;
+    }
+
+    uint64_t time = hostMicros();
+    port.bytes += count;
+    port.reader.feed(buffer, count,
+                     [&](const DeviceRecord &record, const std::string &line) { handle(time, record, line); });
+  }
+}
+
+#endif
@@ -0,0 +1,334 @@
+/**
+ * Reads the serial output of many boards at once and writes one merged record stream.
+ *
+ * Every port (a USB serial port of a board or a pty standing in for one) is opened non-blocking
+ * and watched by a single epoll loop. Readable ports are drained until EAGAIN, so the kernel
+ * buffers never fill up; the pulse frames of "trace stream" are taken out (pulse_stream.h), the
+ * rest is split into lines and decoded with the board's own decoder, and every record is tagged
+ * with board and channel and the host time of the read and appended to an output buffer that is
+ * written once per loop pass (stream_format.h). A port that hangs up (board unplugged or
+ * reset, pty closed) is closed and opened again every second.
+ *
+ * Ports are given as PATH[:BOARD[:CHANNEL]]; without a board number the position in the list is
+ * used. --ports reads further specs from a file, one per line.
+ *
+ * With --shm the records are also published into a shared-memory ring (shm_ring.h) for live
+ * readers such as stream_tail; without --output the stream then goes nowhere else.
+ *
+ * With --sync the clock of every board is synchronised with the host every SECONDS: a round of
+ * "sync <token>" exchanges, 25 ms apart so each one meets an idle command task, feeds the
+ * board's ClockSync (clock_sync.h), and all device times are converted to host times in the
+ * host_time column. Every round writes "# sync board B channel C: ..." with the offset, drift
+ * and uncertainty. The clock is synchronised anew after a board hung up or was reset.
+ *
+ * Usage: capture_daemon [PORT...] [--ports FILE] [--baud N] [--output FILE] [--shm NAME [--shm-slots N]]
+ *                       [--sync SECONDS]
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "board_port.h"
+#include "clock_sync.h"
+#include "shm_ring.h"
+#include "stream_format.h"
+
+const int reopenMillis = 1000;
+const int syncExchangeMillis = 25;
+
+/**
+ * Clock sync of one port: the estimate and the exchanges left in the current round.
+ */
+struct PortSync
+{
+  ClockSync clock;
+  uint64_t nextRound = 0;
+  uint64_t nextExchange = 0;
+  int exchangesLeft = 0;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+static bool writeAll(int fd, std::string &out)
+{
+  size_t done = 0;
+  while (done < out.size())
+  {
+    ssize_t count = write(fd, out.data() + done, out.size() - done);
+    if (count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count <= 0)
+    {
+      return false;
+    }
+    done += count;
+  }
+  out.clear();
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<std::string> specs;
+  int baud = 115200;
+  const char *outputPath = nullptr;
+  const char *shmName = nullptr;
+  uint64_t shmSlots = 65536;
+  double syncSeconds = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+    {
+      baud = std::atoi(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      outputPath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--shm") == 0 && i + 1 < argc)
+    {
+      shmName = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--shm-slots") == 0 && i + 1 < argc)
+    {
+      shmSlots = std::strtoull(argv[++i], 0, 10);
+    }
+    else if (std::strcmp(argv[i], "--sync") == 0 && i + 1 < argc)
+    {
+      syncSeconds = std::atof(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--ports") == 0 && i + 1 < argc)
+    {
+      std::ifstream list(argv[++i]);
+      if (!list)
+      {
+        std::perror(argv[i]);
+        return 1;
+      }
+      std::string line;
+      while (std::getline(list, line))
+      {
+        if (!line.empty() && line[0] != '#')
+        {
+          specs.push_back(line);
+        }
+      }
+    }
+    else if (argv[i][0] != '-')
+    {
+      specs.push_back(argv[i]);
+    }
+    else
+    {
+      std::fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (specs.empty())
+  {
+    std::fprintf(stderr, "usage: %s [PATH[:BOARD[:CHANNEL]]...] [--ports FILE] [--baud N] [--output FILE]\n"
+                         "       [--shm NAME [--shm-slots N]] [--sync SECONDS]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  // one descriptor per port; hundreds of ports exceed the usual soft limit of 1024 quickly
+  rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max)
+  {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  int output = shmName ? -1 : STDOUT_FILENO;
+  if (outputPath)
+  {
+    output = open(outputPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (output < 0)
+    {
+      std::perror(outputPath);
+      return 1;
+    }
+  }
+
+  ShmRingWriter ring;
+  std::string error;
+  if (shmName && !ring.open(shmName, shmSlots, error))
+  {
+    std::fprintf(stderr, "%s: %s\n", shmName, error.c_str());
+    return 1;
+  }
+
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll < 0)
+  {
+    std::perror("epoll_create1");
+    return 1;
+  }
+
+  // the ports never move, epoll keeps pointers to them
+  std::vector<BoardPort> ports(specs.size());
+  std::vector<PortSync> syncs(specs.size());
+  for (size_t i = 0; i < specs.size(); i++)
+  {
+    if (!parseBoardPort(specs[i], (uint16_t)i, ports[i]))
+    {
+      std::fprintf(stderr, "bad port: %s\n", specs[i].c_str());
+      return 2;
+    }
+    if (!openBoardPort(epoll, ports[i], baud))
+    {
+      std::fprintf(stderr, "%s: %s, retrying\n", ports[i].path.c_str(), std::strerror(errno));
+    }
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::string out = output >= 0 ? std::string(streamHeader) + "\n" : "";
+  std::vector<epoll_event> events(ports.size());
+  uint64_t lastReopen = hostMicros();
+  int waitMillis = syncSeconds > 0 ? syncExchangeMillis : reopenMillis;
+
+  while (!stopRequested)
+  {
+    if (!writeAll(output, out))
+    {
+      std::perror("write");
+      break;
+    }
+
+    int ready = epoll_wait(epoll, events.data(), events.size(), waitMillis);
+    if (ready < 0 && errno != EINTR)
+    {
+      std::perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < ready; i++)
+    {
+      BoardPort &port = *(BoardPort *)events[i].data.ptr;
+      ClockSync &clock = syncs[&port - ports.data()].clock;
+      auto append = [&](uint64_t time, const DeviceRecord &record, const std::string &line) {
+        if (record.type == DeviceRecord::SYNC)
+        {
+          clock.reply(record.value, record.time, time);
+        }
+        else if (record.type == DeviceRecord::TEXT && line.compare(0, 6, "Reset:") == 0)
+        {
+          // the clock of the board starts again at 0
+          clock.reset();
+        }
+
+        uint64_t hostTime = record.time > 0 && clock.synchronised() ? clock.toHost(record.time) : 0;
+        if (output >= 0)
+        {
+          appendStreamRecord(out, time, port.board, port.channel, record, hostTime, line.data(), line.size());
+        }
+        if (shmName)
+        {
+          ring.publish(time, port.board, port.channel, record, hostTime, line.data(), line.size());
+        }
+      };
+      // drain first, a hangup can come together with the last bytes
+      if (!drainBoardPort(port, append) || (events[i].events & (EPOLLHUP | EPOLLERR)))
+      {
+        std::fprintf(stderr, "%s: hung up\n", port.path.c_str());
+        closeBoardPort(epoll, port);
+        clock.reset();
+      }
+    }
+
+    if (syncSeconds > 0)
+    {
+      uint64_t now = hostMicros();
+      for (size_t i = 0; i < ports.size(); i++)
+      {
+        BoardPort &port = ports[i];
+        PortSync &sync = syncs[i];
+        if (port.fd < 0)
+        {
+          continue;
+        }
+
+        if (now >= sync.nextRound)
+        {
+          sync.clock.startRound();
+          if (sync.clock.synchronised() && output >= 0)
+          {
+            char comment[160];
+            std::snprintf(comment, sizeof(comment),
+                          "# sync board %u channel %u: offset %.0f us drift %+.1f ppm +- %.0f us rtt %llu us\n",
+                          port.board, port.channel, sync.clock.offset(), sync.clock.driftPpm(),
+                          sync.clock.uncertainty(), (unsigned long long)sync.clock.roundTrip());
+            out += comment;
+          }
+          sync.nextRound = now + (uint64_t)(syncSeconds * 1e6);
+          sync.exchangesLeft = ClockSync::roundExchanges;
+        }
+
+        if (sync.exchangesLeft > 0 && now >= sync.nextExchange)
+        {
+          // a full port buffer loses the request, the round then ends with fewer answers
+          char request[32];
+          int length = std::snprintf(request, sizeof(request), "sync %llu\n",
+                                     (unsigned long long)sync.clock.request(hostMicros()));
+          if (write(port.fd, request, length) < 0 && errno != EAGAIN)
+          {
+            std::fprintf(stderr, "%s: %s\n", port.path.c_str(), std::strerror(errno));
+          }
+          sync.exchangesLeft--;
+          sync.nextExchange = now + syncExchangeMillis * 1000ULL;
+        }
+      }
+    }
+
+    if (hostMicros() - lastReopen >= reopenMillis * 1000ULL)
+    {
+      lastReopen = hostMicros();
+      for (BoardPort &port : ports)
+      {
+        if (port.fd < 0 && openBoardPort(epoll, port, baud))
+        {
+          port.reopens++;
+          std::fprintf(stderr, "%s: reopened\n", port.path.c_str());
+        }
+      }
+    }
+  }
+  writeAll(output, out);
+
+  uint64_t bytes = 0, lines = 0;
+  for (const BoardPort &port : ports)
+  {
+    bytes += port.bytes;
+    lines += port.reader.lines;
+    if (port.reader.stream.longLines > 0 || port.reopens > 0)
+    {
+      std::fprintf(stderr, "%s: %llu long lines split, %llu reopens\n", port.path.c_str(),
+                   (unsigned long long)port.reader.stream.longLines, (unsigned long long)port.reopens);
+    }
+  }
+  std::fprintf(stderr, "%zu ports, %llu bytes, %llu lines\n", ports.size(), (unsigned long long)bytes,
+               (unsigned long long)lines);
+  return 0;
+}
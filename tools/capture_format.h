@@ -0,0 +1,357 @@
+/**
+ * Columnar capture files of measurement runs.
+ *
+ * Layout, all integers little-endian, every block aligned to 8 bytes:
+ *
+ *   CaptureHeader    magic, version, run count and the offsets of the sections below
+ *   run blocks       per run its CaptureRun, the uint32 pulse count per cycle and the pulse
+ *                    timestamps as LEB128 varints of the delta to the previous pulse; the first
+ *                    delta is counted from the start of the run
+ *   run index        a copy of the CaptureRun of every run
+ *
+ * Runs are found in O(1) through the index, which points into the blocks. The reader maps the
+ * file and decodes only the runs it is asked for.
+ *
+ * The header is written with an index offset of 0 when the file is opened and each run block is
+ * flushed when it is added; close() appends the index and fills in the header. A file that was
+ * never closed (the capture crashed or was killed) has no index, and the reader finds its runs
+ * by scanning the blocks, up to the first incomplete one.
+ */
+
+#ifndef CAPTURE_FORMAT_H
+#define CAPTURE_FORMAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "capture files are little-endian");
+
+const char captureMagic[8] = {'F', 'L', 'O', 'W', 'C', 'A', 'P', '1'};
+const uint32_t captureVersion = 2;
+const int64_t captureNoWeight = INT64_MIN;
+
+struct CaptureHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t runCount;     // 0 until the file is closed
+  uint64_t blockOffset;  // offset of the first run block
+  uint64_t blockBytes;   // bytes of all run blocks, 0 until the file is closed
+  uint64_t indexOffset;  // 0 until the file is closed
+  uint64_t reserved[3];
+};
+static_assert(sizeof(CaptureHeader) == 64, "header layout");
+
+struct CaptureRun
+{
+  uint64_t startMicros;      // device time of the measurement start
+  uint64_t gateMicros;       // total time the valve was open
+  uint64_t pulses;           // pulse total reported by the firmware
+  uint64_t pulseOffset;      // file offset of the pulse timestamps of the run
+  uint64_t pulseBytes;       // bytes of the pulse timestamps
+  uint64_t pulseTimestamps;  // number of recorded pulse timestamps, 0 without a trace
+  uint64_t cycleOffset;      // file offset of the per-cycle counts of the run
+  int64_t weightMilligrams;  // captureNoWeight without a scale
+  uint32_t seconds;          // gate time per cycle
+  uint32_t cycles;           // number of cycles
+  uint16_t board;            // board the run came from
+  uint16_t channel;          // channel of the board
+  uint32_t cycleCount;       // number of per-cycle results in the cycle column
+};
+static_assert(sizeof(CaptureRun) == 80, "run layout");
+
+/**
+ * A run as collected by the writer.
+ */
+struct CaptureRunData
+{
+  CaptureRun run = {};
+  std::vector<uint64_t> pulseTimes;
+  std::vector<uint32_t> cycles;
+};
+
+/**
+ * Appends an unsigned LEB128 varint.
+ */
+inline void appendVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+/**
+ * Decodes an unsigned LEB128 varint and advances the pointer; a varint cut off at end reads as
+ * the bytes up to end.
+ */
+inline uint64_t readVarint(const uint8_t *&in, const uint8_t *end)
+{
+  uint64_t value = 0;
+  int shift = 0;
+  uint8_t byte = 0x80;
+  while ((byte & 0x80) && in < end && shift < 64)
+  {
+    byte = *in++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    shift += 7;
+  }
+  return value;
+}
+
+/**
+ * Returns the offset rounded up to the block alignment.
+ */
+inline uint64_t alignCapture(uint64_t offset)
+{
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+class CaptureWriter
+{
+public:
+  uint64_t backwardPulses = 0; // pulse times before the previous one, stored with a delta of 0
+
+  ~CaptureWriter() { close(); }
+
+  bool open(const char *path)
+  {
+    file = std::fopen(path, "wb");
+    if (!file)
+    {
+      return false;
+    }
+
+    // a provisional header without an index, filled in on close()
+    header = {};
+    std::memcpy(header.magic, captureMagic, sizeof(captureMagic));
+    header.version = captureVersion;
+    header.blockOffset = sizeof(CaptureHeader);
+    offset = header.blockOffset;
+    runs.clear();
+    return std::fwrite(&header, sizeof(header), 1, file) == 1 && std::fflush(file) == 0;
+  }
+
+  /**
+   * Appends a run. Returns false if it could not be written, e.g. on a full disk; the file then
+   * ends with the previous run and the run is not indexed.
+   */
+  bool add(CaptureRunData &data)
+  {
+    buffer.clear();
+    uint64_t previous = data.run.startMicros;
+    for (uint64_t time : data.pulseTimes)
+    {
+      backwardPulses += time < previous;
+      appendVarint(buffer, time >= previous ? time - previous : 0);
+      previous = time > previous ? time : previous;
+    }
+
+    CaptureRun run = data.run;
+    run.cycleOffset = offset + sizeof(CaptureRun);
+    run.cycleCount = data.cycles.size();
+    run.pulseOffset = run.cycleOffset + data.cycles.size() * sizeof(uint32_t);
+    run.pulseBytes = buffer.size();
+    run.pulseTimestamps = data.pulseTimes.size();
+    uint64_t end = run.pulseOffset + run.pulseBytes;
+    buffer.resize(buffer.size() + alignCapture(end) - end);
+
+    // flushed per run, so a crash loses at most the run being collected
+    bool ok = std::fwrite(&run, sizeof(run), 1, file) == 1 &&
+              std::fwrite(data.cycles.data(), sizeof(uint32_t), data.cycles.size(), file) == data.cycles.size() &&
+              std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() && std::fflush(file) == 0;
+    if (!ok)
+    {
+      // drop the partial block, the next run is written in its place
+      std::clearerr(file);
+      std::fseek(file, offset, SEEK_SET);
+      if (ftruncate(fileno(file), offset) != 0)
+      {
+        std::perror("ftruncate");
+      }
+      return false;
+    }
+    offset = alignCapture(end);
+    runs.push_back(run);
+    return true;
+  }
+
+  bool close()
+  {
+    if (!file)
+    {
+      return true;
+    }
+
+    header.runCount = runs.size();
+    header.blockBytes = offset - header.blockOffset;
+    header.indexOffset = offset;
+    bool ok = std::fwrite(runs.data(), sizeof(CaptureRun), runs.size(), file) == runs.size() &&
+              std::fflush(file) == 0;
+
+    // without a complete index the header stays provisional, and the reader scans the blocks
+    if (ok)
+    {
+      std::fseek(file, 0, SEEK_SET);
+      ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+    return ok;
+  }
+
+private:
+  FILE *file = nullptr;
+  CaptureHeader header = {};
+  uint64_t offset = 0; // end of the last run block
+  std::vector<uint8_t> buffer;
+  std::vector<CaptureRun> runs;
+};
+
+class CaptureReader
+{
+public:
+  ~CaptureReader()
+  {
+    if (data)
+    {
+      munmap(const_cast<uint8_t *>(data), size);
+    }
+  }
+
+  bool open(const char *path, std::string &error)
+  {
+    int fd = ::open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+      error = std::string("cannot open ") + path;
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+      return false;
+    }
+
+    size = info.st_size;
+    void *mapping = size >= sizeof(CaptureHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+      error = std::string(path) + " is not a capture file";
+      return false;
+    }
+    data = static_cast<const uint8_t *>(mapping);
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    header = reinterpret_cast<const CaptureHeader *>(data);
+    if (std::memcmp(header->magic, captureMagic, sizeof(captureMagic)) != 0 || header->version != captureVersion ||
+        header->blockOffset < sizeof(CaptureHeader) || header->blockOffset > size)
+    {
+      error = std::string(path) + " is not a valid capture file";
+      return false;
+    }
+
+    if (header->indexOffset == 0)
+    {
+      // never closed: collect the complete run blocks
+      recovering = true;
+      uint64_t offset = header->blockOffset;
+      while (offset + sizeof(CaptureRun) <= size)
+      {
+        const CaptureRun &run = *reinterpret_cast<const CaptureRun *>(data + offset);
+        if (run.cycleOffset != offset + sizeof(CaptureRun) || !validRun(run))
+        {
+          break;
+        }
+        scanned.push_back(run);
+        offset = alignCapture(run.pulseOffset + run.pulseBytes);
+      }
+      index = scanned.data();
+      count = scanned.size();
+      return true;
+    }
+
+    if (header->indexOffset % 8 != 0 || header->indexOffset > size ||
+        header->runCount > (size - header->indexOffset) / sizeof(CaptureRun))
+    {
+      error = std::string(path) + " is not a valid capture file";
+      return false;
+    }
+    index = reinterpret_cast<const CaptureRun *>(data + header->indexOffset);
+    count = header->runCount;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (!validRun(index[i]))
+      {
+        error = std::string(path) + ": run " + std::to_string(i) + " points outside the file";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t runCount() const { return count; }
+
+  /**
+   * True if the file was not closed and its runs were found by scanning.
+   */
+  bool recovered() const { return recovering; }
+
+  const CaptureRun &run(uint32_t number) const
+  {
+    return index[number];
+  }
+
+  const uint32_t *cycles(const CaptureRun &run) const
+  {
+    return reinterpret_cast<const uint32_t *>(data + run.cycleOffset);
+  }
+
+  /**
+   * Calls visit(time) for every pulse timestamp of the run.
+   */
+  template <typename Visitor>
+  void pulses(const CaptureRun &run, Visitor visit) const
+  {
+    const uint8_t *in = data + run.pulseOffset;
+    const uint8_t *end = in + run.pulseBytes;
+    uint64_t time = run.startMicros;
+    for (uint64_t i = 0; i < run.pulseTimestamps && in < end; i++)
+    {
+      time += readVarint(in, end);
+      visit(time);
+    }
+  }
+
+private:
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  const CaptureHeader *header = nullptr;
+  const CaptureRun *index = nullptr;
+  uint32_t count = 0;
+  bool recovering = false;
+  std::vector<CaptureRun> scanned; // the runs of a file without index
+
+  /**
+   * True if the cycles and pulses of the run lie within the file, after the header.
+   */
+  bool validRun(const CaptureRun &run) const
+  {
+    return run.cycleOffset >= header->blockOffset && run.cycleOffset % 4 == 0 && run.cycleOffset <= size &&
+           run.cycleCount <= (size - run.cycleOffset) / sizeof(uint32_t) &&
+           run.pulseOffset == run.cycleOffset + run.cycleCount * sizeof(uint32_t) &&
+           run.pulseBytes <= size - run.pulseOffset && run.pulseTimestamps <= run.pulseBytes;
+  }
+};
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * Queries a capture file written by capture.
+ *
+ * Usage: capture_query FILE              list the runs
+ *        capture_query FILE --run N      show run N with its cycles
+ *        capture_query FILE --pulses N   print the pulse timestamps of run N
+ *        capture_query FILE --scan       decode every pulse and report interval statistics
+ */
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "capture_format.h"
+
+static void printRun(uint32_t index, const CaptureRun &run)
+{
+  std::printf("%6u  board %u ch %u  start %" PRIu64 "us  %us x %u  gate %" PRIu64 "us  pulses %" PRIu64
+              "  timestamps %" PRIu64,
+              index, run.board, run.channel, run.startMicros, run.seconds, run.cycles, run.gateMicros, run.pulses,
+              run.pulseTimestamps);
+  if (run.weightMilligrams != captureNoWeight)
+  {
+    std::printf("  weight %.3fg", run.weightMilligrams / 1000.0);
+  }
+  std::printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "usage: %s FILE [--run N | --pulses N | --scan]\n", argv[0]);
+    return 2;
+  }
+
+  CaptureReader reader;
+  std::string error;
+  if (!reader.open(argv[1], error))
+  {
+    std::fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  if (reader.recovered())
+  {
+    std::fprintf(stderr, "%s was not closed, %u complete runs recovered\n", argv[1], reader.runCount());
+  }
+
+  const char *option = argc > 2 ? argv[2] : "";
+  long index = argc > 3 ? std::atol(argv[3]) : -1;
+
+  if ((std::strcmp(option, "--run") == 0 || std::strcmp(option, "--pulses") == 0) &&
+      (index < 0 || index >= (long)reader.runCount()))
+  {
+    std::fprintf(stderr, "run %ld does not exist, the file has %u runs\n", index, reader.runCount());
+    return 1;
+  }
+
+  if (std::strcmp(option, "--run") == 0)
+  {
+    const CaptureRun &run = reader.run(index);
+    printRun(index, run);
+    const uint32_t *cycles = reader.cycles(run);
+    for (uint32_t i = 0; i < run.cycleCount; i++)
+    {
+      std::printf("  cycle %u: %u pulses\n", i + 1, cycles[i]);
+    }
+  }
+  else if (std::strcmp(option, "--pulses") == 0)
+  {
+    reader.pulses(reader.run(index), [](uint64_t time) { std::printf("%" PRIu64 "\n", time); });
+  }
+  else if (std::strcmp(option, "--scan") == 0)
+  {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t count = 0;
+    uint64_t minimum = UINT64_MAX, maximum = 0, sum = 0;
+
+    for (uint32_t i = 0; i < reader.runCount(); i++)
+    {
+      const CaptureRun &run = reader.run(i);
+      uint64_t previous = run.startMicros;
+      reader.pulses(run, [&](uint64_t time) {
+        uint64_t interval = time - previous;
+        previous = time;
+        minimum = interval < minimum ? interval : minimum;
+        maximum = interval > maximum ? interval : maximum;
+        sum += interval;
+        count++;
+      });
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%" PRIu64 " pulses in %u runs decoded in %.2f s\n", count, reader.runCount(), seconds);
+    if (count > 0)
+    {
+      std::printf("interval min %" PRIu64 "us  mean %.1fus  max %" PRIu64 "us\n", minimum, (double)sum / count, maximum);
+    }
+  }
+  else
+  {
+    for (uint32_t i = 0; i < reader.runCount(); i++)
+    {
+      printRun(i, reader.run(i));
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * Estimates the clock of a board against the host clock, NTP-style.
+ *
+ * The host sends "sync <token>" and notes the time; the board answers "Sync: <token> <micros>"
+ * with its clock when the line ending of the request arrived, sent ahead of its queued output. The
+ * device time is paired with the middle of the round trip on the host. Delays in the USB stack
+ * and the serial line make most exchanges asymmetric, so every round of exchanges only keeps the
+ * one with the shortest round trip, whose error is at most half of it. A straight line through the kept rounds gives the
+ * offset and the drift of the board clock, and converts device times to host times.
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <cmath>
+#include <cstdint>
+#include <deque>
+
+class ClockSync
+{
+public:
+  static const int roundExchanges = 8;        // exchanges per round, the fastest one is kept
+  static const size_t keptRounds = 16;        // rounds the line is fitted through
+  static const uint64_t maxRoundTrip = 500000; // later answers are dropped
+
+  /**
+   * Starts a round of exchanges; ends the previous one if it got answers.
+   */
+  void startRound()
+  {
+    endRound();
+  }
+
+  /**
+   * Returns the token of a new exchange sent at the given host time.
+   */
+  uint64_t request(uint64_t hostMicros)
+  {
+    uint64_t token = ++lastToken;
+    sent[token % pendingSlots] = {token, hostMicros};
+    return token;
+  }
+
+  /**
+   * Takes the answer of the board to an exchange.
+   */
+  void reply(uint64_t token, uint64_t deviceMicros, uint64_t hostMicros)
+  {
+    const Pending &pending = sent[token % pendingSlots];
+    if (pending.token != token || hostMicros < pending.hostMicros || hostMicros - pending.hostMicros > maxRoundTrip)
+    {
+      return;
+    }
+    if (!rounds.empty() && deviceMicros < rounds.back().device)
+    {
+      // the board was reset, its clock started again
+      reset();
+    }
+
+    uint64_t roundTrip = hostMicros - pending.hostMicros;
+    if (roundSamples == 0 || roundTrip < best.roundTrip)
+    {
+      best = {deviceMicros, pending.hostMicros + roundTrip / 2, roundTrip};
+    }
+    if (++roundSamples == roundExchanges)
+    {
+      endRound();
+    }
+  }
+
+  /**
+   * Forgets everything, e.g. after the board was reset.
+   */
+  void reset()
+  {
+    rounds.clear();
+    roundSamples = 0;
+    slope = 1;
+    residual = 0;
+  }
+
+  bool synchronised() const { return !rounds.empty(); }
+
+  /**
+   * Converts a device time to host time, in microseconds since the epoch.
+   */
+  uint64_t toHost(uint64_t deviceMicros) const
+  {
+    const Sample &reference = rounds.back();
+    double offset = intercept + slope * ((double)deviceMicros - (double)reference.device);
+    return reference.host + (int64_t)std::llround(offset);
+  }
+
+  /**
+   * Host time minus device time now, in microseconds.
+   */
+  double offset() const
+  {
+    const Sample &reference = rounds.back();
+    return (double)reference.host + intercept - (double)reference.device;
+  }
+
+  /**
+   * How much faster the board clock runs than the host clock, in parts per million.
+   */
+  double driftPpm() const { return (1 / slope - 1) * 1e6; }
+
+  /**
+   * Bound of the conversion error: half the last kept round trip plus the scatter of the rounds
+   * around the line.
+   */
+  double uncertainty() const { return rounds.back().roundTrip / 2.0 + residual; }
+
+  uint64_t roundTrip() const { return rounds.back().roundTrip; }
+
+private:
+  struct Sample
+  {
+    uint64_t device;
+    uint64_t host;
+    uint64_t roundTrip;
+  };
+
+  struct Pending
+  {
+    uint64_t token;
+    uint64_t hostMicros;
+  };
+
+  static const size_t pendingSlots = 64;
+
+  void endRound()
+  {
+    if (roundSamples == 0)
+    {
+      return;
+    }
+    roundSamples = 0;
+    rounds.push_back(best);
+    if (rounds.size() > keptRounds)
+    {
+      rounds.pop_front();
+    }
+    fit();
+  }
+
+  /**
+   * Least squares line host = host0 + intercept + slope * (device - device0) through the rounds,
+   * relative to the last one so the doubles keep their precision. The drift needs a few seconds
+   * of device time; until then the clocks are assumed to run at the same rate.
+   */
+  void fit()
+  {
+    const Sample &reference = rounds.back();
+    double n = rounds.size();
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const Sample &sample : rounds)
+    {
+      double x = (double)sample.device - (double)reference.device;
+      double y = (double)sample.host - (double)reference.host - x;
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+    }
+
+    double span = (double)(reference.device - rounds.front().device);
+    double denominator = n * sxx - sx * sx;
+    double excess = span >= 2e6 && denominator > 0 ? (n * sxy - sx * sy) / denominator : 0;
+    slope = 1 + excess;
+    intercept = (sy - excess * sx) / n;
+
+    double squares = 0;
+    for (const Sample &sample : rounds)
+    {
+      double x = (double)sample.device - (double)reference.device;
+      double error = (double)sample.host - (double)reference.host - (intercept + slope * x);
+      squares += error * error;
+    }
+    residual = std::sqrt(squares / n);
+  }
+
+  std::deque<Sample> rounds;
+  Pending sent[pendingSlots] = {};
+  Sample best = {};
+  int roundSamples = 0;
+  uint64_t lastToken = 0;
+  double slope = 1;
+  double intercept = 0;
+  double residual = 0;
+};
+
+#endif
@@ -0,0 +1,496 @@
+/**
+ * Live terminal dashboard of all boards and channels of a bench.
+ *
+ * Follows the shared-memory ring of capture_daemon (--shm NAME) or reads a record stream
+ * (stream_format.h) from a file or stdin, and shows one row per board and channel: the state of
+ * the run, the cycle, the progress of the gate, the pulse rate, the pulses so far and the counts
+ * of the finished cycles, or the result of the last run.
+ *
+ * Records only update the state of their channel and mark it dirty. The screen is redrawn at a
+ * fixed frame rate: only dirty channels on the screen are formatted again and only rows that
+ * changed are written, so the cost of a frame depends on the size of the terminal, not on the
+ * number of channels.
+ *
+ * Usage: dashboard --shm NAME | FILE | -   [--fps N] [--frames N]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "shm_ring.h"
+#include "stream_format.h"
+
+const size_t shownCycles = 10;
+const size_t maxLineLength = 1024; // longer input lines are dropped
+
+enum ChannelState
+{
+  CHANNEL_WAITING,
+  CHANNEL_RUNNING,
+  CHANNEL_DONE,
+  CHANNEL_ABORTED,
+  CHANNEL_RESET
+};
+
+struct Channel
+{
+  uint16_t board = 0;
+  uint16_t channel = 0;
+  ChannelState state = CHANNEL_WAITING;
+  uint64_t seconds = 0;
+  uint64_t cycles = 0;
+  uint64_t cycle = 0;
+  uint64_t finishedPulses = 0;     // pulses of the finished cycles
+  uint64_t gatePulses = 0;         // pulses of the running cycle from the progress lines
+  uint64_t tracedPulses = 0;       // pulses of the run from the trace, if traced
+  uint64_t elapsed = 0;            // seconds of the running gate
+  uint64_t rate = 0;
+  uint64_t total = 0;
+  double weight = -1;
+  std::vector<uint64_t> cycleCounts;
+  bool dirty = true;
+  std::string row;
+};
+
+struct Dashboard
+{
+  std::vector<Channel> channels;
+  std::unordered_map<uint32_t, size_t> index;
+  uint64_t records = 0;
+  uint64_t lost = 0;
+
+  Channel &find(uint16_t board, uint16_t channel)
+  {
+    uint32_t key = (uint32_t)board << 16 | channel;
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+      return channels[found->second];
+    }
+
+    // keep the rows sorted by board and channel; new channels are rare, rebuilding is fine
+    Channel added;
+    added.board = board;
+    added.channel = channel;
+    auto position = std::lower_bound(channels.begin(), channels.end(), key, [](const Channel &c, uint32_t k) {
+      return ((uint32_t)c.board << 16 | c.channel) < k;
+    });
+    position = channels.insert(position, added);
+    index.clear();
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+      channels[i].dirty = true;
+      index[(uint32_t)channels[i].board << 16 | channels[i].channel] = i;
+    }
+    return *position;
+  }
+
+  void update(uint16_t board, uint16_t channel, const DeviceRecord &record, const char *line)
+  {
+    records++;
+    Channel &c = find(board, channel);
+
+    switch (record.type)
+    {
+    case DeviceRecord::RUN_START:
+      c.state = CHANNEL_RUNNING;
+      c.seconds = record.value;
+      c.cycles = record.extra;
+      c.cycle = 1;
+      c.finishedPulses = c.gatePulses = c.tracedPulses = c.elapsed = c.rate = 0;
+      c.weight = -1;
+      c.cycleCounts.clear();
+      break;
+    case DeviceRecord::PROGRESS:
+      c.elapsed = record.value;
+      c.rate = record.extra;
+      c.gatePulses += record.extra;
+      break;
+    case DeviceRecord::TRACE_EVENT:
+      if (record.event != 'P')
+      {
+        return;
+      }
+      c.tracedPulses++;
+      break;
+    case DeviceRecord::CYCLE:
+      c.finishedPulses += record.extra;
+      c.cycleCounts.push_back(record.extra);
+      c.cycle = std::min(c.cycles, record.value + 1);
+      c.gatePulses = c.elapsed = 0;
+      break;
+    case DeviceRecord::PULSES:
+      c.state = CHANNEL_DONE;
+      c.total = record.value;
+      break;
+    case DeviceRecord::ABORTED:
+      c.state = CHANNEL_ABORTED;
+      c.total = record.value;
+      break;
+    case DeviceRecord::WEIGHT:
+      c.weight = record.number;
+      break;
+    case DeviceRecord::TEXT:
+      if (std::strncmp(line, "Reset:", 6) != 0)
+      {
+        return;
+      }
+      c.state = CHANNEL_RESET;
+      break;
+    default:
+      return;
+    }
+    c.dirty = true;
+  }
+};
+
+static void formatRow(Channel &c, int width)
+{
+  char text[512];
+  int length = std::snprintf(text, sizeof(text), "%3u.%-2u ", c.board, c.channel);
+
+  if (c.state == CHANNEL_WAITING || c.state == CHANNEL_RESET)
+  {
+    length += std::snprintf(text + length, sizeof(text) - length, "%s", c.state == CHANNEL_RESET ? "RESET" : "-");
+  }
+  else if (c.state == CHANNEL_RUNNING)
+  {
+    const int barWidth = 10;
+    int filled = c.seconds > 0 ? (int)std::min<uint64_t>(barWidth, c.elapsed * barWidth / c.seconds) : 0;
+    char bar[barWidth + 1];
+    for (int i = 0; i < barWidth; i++)
+    {
+      bar[i] = i < filled ? '#' : '.';
+    }
+    bar[barWidth] = '\0';
+
+    uint64_t pulses = c.tracedPulses > 0 ? c.tracedPulses : c.finishedPulses + c.gatePulses;
+    length += std::snprintf(text + length, sizeof(text) - length,
+                            "RUN  %4llus x%-3llu %3llu/%-3llu [%s] %4llus %6llu/s %9llu",
+                            (unsigned long long)c.seconds, (unsigned long long)c.cycles, (unsigned long long)c.cycle,
+                            (unsigned long long)c.cycles, bar, (unsigned long long)c.elapsed,
+                            (unsigned long long)c.rate, (unsigned long long)pulses);
+  }
+  else
+  {
+    length += std::snprintf(text + length, sizeof(text) - length, "%s %4llus x%-3llu %9llu pulses",
+                            c.state == CHANNEL_ABORTED ? "STOP" : "DONE", (unsigned long long)c.seconds, (unsigned long long)c.cycles, (unsigned long long)c.total);
+    if (c.weight >= 0)
+    {
+      length += std::snprintf(text + length, sizeof(text) - length, " %9.1fg", c.weight);
+    }
+  }
+
+  // the counts of the last finished cycles
+  if (!c.cycleCounts.empty() && length < (int)sizeof(text))
+  {
+    length += std::snprintf(text + length, sizeof(text) - length, "  |");
+    size_t first = c.cycleCounts.size() > shownCycles ? c.cycleCounts.size() - shownCycles : 0;
+    for (size_t i = first; i < c.cycleCounts.size() && length < (int)sizeof(text); i++)
+    {
+      length += std::snprintf(text + length, sizeof(text) - length, " %llu", (unsigned long long)c.cycleCounts[i]);
+    }
+  }
+
+  length = std::min(length, (int)sizeof(text) - 1);
+  c.row.assign(text, std::min(length, width));
+  c.dirty = false;
+}
+
+/**
+ * Terminal output that only rewrites rows that differ from the last frame.
+ */
+class Screen
+{
+public:
+  void begin()
+  {
+    // alternate screen, cursor hidden
+    std::fputs("\x1b[?1049h\x1b[?25l", stdout);
+    invalidate();
+  }
+
+  void end()
+  {
+    std::fputs("\x1b[?25h\x1b[?1049l", stdout);
+    std::fflush(stdout);
+  }
+
+  void invalidate()
+  {
+    winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0)
+    {
+      rows = size.ws_row;
+      columns = size.ws_col;
+    }
+    shown.assign(rows, std::string(1, '\0'));
+    out += "\x1b[2J";
+  }
+
+  void setRow(int row, const std::string &text)
+  {
+    if (row >= rows || shown[row] == text)
+    {
+      return;
+    }
+    shown[row] = text;
+    char position[32];
+    std::snprintf(position, sizeof(position), "\x1b[%d;1H", row + 1);
+    out += position;
+    out += text;
+    out += "\x1b[K";
+  }
+
+  void flush()
+  {
+    if (!out.empty())
+    {
+      std::fwrite(out.data(), 1, out.size(), stdout);
+      std::fflush(stdout);
+      out.clear();
+    }
+  }
+
+  int rows = 24;
+  int columns = 80;
+
+private:
+  std::vector<std::string> shown;
+  std::string out;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t resized = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+static void requestResize(int)
+{
+  resized = 1;
+}
+
+static void render(Dashboard &dashboard, Screen &screen, double recordsPerSecond)
+{
+  char header[160];
+  std::snprintf(header, sizeof(header), "flowmeter dashboard  %zu channels  %.0f records/s  %llu lost",
+                dashboard.channels.size(), recordsPerSecond, (unsigned long long)dashboard.lost);
+  screen.setRow(0, std::string(header).substr(0, screen.columns));
+  screen.setRow(1, std::string("board  run         cycle    gate         time   rate     pulses | cycles").substr(0, screen.columns));
+
+  int available = screen.rows - 2;
+  size_t shown = std::min<size_t>(dashboard.channels.size(), available);
+  if (shown < dashboard.channels.size() && shown > 0)
+  {
+    shown--;
+  }
+
+  for (size_t i = 0; i < shown; i++)
+  {
+    Channel &c = dashboard.channels[i];
+    if (c.dirty)
+    {
+      formatRow(c, screen.columns);
+    }
+    screen.setRow(2 + i, c.row);
+  }
+  if (shown < dashboard.channels.size())
+  {
+    screen.setRow(2 + shown, "... " + std::to_string(dashboard.channels.size() - shown) + " more channels");
+  }
+  screen.flush();
+}
+
+int main(int argc, char **argv)
+{
+  const char *shmName = nullptr;
+  const char *path = nullptr;
+  double fps = 10;
+  long frames = -1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--shm") == 0 && i + 1 < argc)
+    {
+      shmName = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+    {
+      fps = std::atof(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+    {
+      frames = std::atol(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "-") == 0 || argv[i][0] != '-')
+    {
+      path = argv[i];
+    }
+    else
+    {
+      std::fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if ((!shmName && !path) || fps <= 0)
+  {
+    std::fprintf(stderr, "usage: %s --shm NAME | FILE | -  [--fps N] [--frames N]\n", argv[0]);
+    return 2;
+  }
+
+  ShmRingReader ring;
+  int input = -1;
+  std::string error;
+  if (shmName && !ring.open(shmName, false, error))
+  {
+    std::fprintf(stderr, "%s: %s\n", shmName, error.c_str());
+    return 1;
+  }
+  if (path)
+  {
+    input = std::strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (input < 0)
+    {
+      std::perror(path);
+      return 1;
+    }
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+  std::signal(SIGWINCH, requestResize);
+
+  Dashboard dashboard;
+  Screen screen;
+  screen.begin();
+
+  using Clock = std::chrono::steady_clock;
+  const auto framePeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / fps));
+  auto nextFrame = Clock::now();
+  auto lastRate = nextFrame;
+  uint64_t recordsAtLastRate = 0;
+  double recordsPerSecond = 0;
+  uint64_t frame = 0;
+  char buffer[4096];
+  std::string pending; // received bytes after the last complete line
+  StreamRecord stream;
+
+  while (!stopRequested && (frames < 0 || (long)frame < frames))
+  {
+    // take in everything that arrived until the next frame is due
+    do
+    {
+      if (shmName)
+      {
+        while (const ShmRecord *record = ring.next())
+        {
+          DeviceRecord decoded;
+          decoded.type = (DeviceRecord::Type)record->type;
+          decoded.event = record->event;
+          decoded.time = record->time;
+          decoded.value = record->value;
+          decoded.extra = record->extra;
+          decoded.number = record->number;
+          std::string text(record->line, record->length);
+          if (ring.stillValid())
+          {
+            dashboard.update(record->board, record->channel, decoded, text.c_str());
+          }
+          if (Clock::now() >= nextFrame)
+          {
+            break;
+          }
+        }
+        dashboard.lost = ring.lost();
+      }
+      if (input >= 0)
+      {
+        // read() and split the lines here: lines left in a stdio buffer would not wake up poll()
+        pollfd descriptor = {input, POLLIN, 0};
+        while (poll(&descriptor, 1, 0) > 0)
+        {
+          ssize_t length = read(input, buffer, sizeof(buffer));
+          if (length <= 0)
+          {
+            // end of the file or of the pipe: the channels keep their last state
+            input = -1;
+            break;
+          }
+          pending.append(buffer, length);
+
+          size_t start = 0;
+          size_t end;
+          while ((end = pending.find('\n', start)) != std::string::npos)
+          {
+            std::string line = pending.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r')
+            {
+              line.pop_back();
+            }
+            if (parseStreamRecord(line.c_str(), stream))
+            {
+              dashboard.update(stream.board, stream.channel, stream.record, stream.line.c_str());
+            }
+            start = end + 1;
+          }
+          pending.erase(0, start);
+          if (pending.size() > maxLineLength)
+          {
+            pending.clear();
+          }
+          if (Clock::now() >= nextFrame)
+          {
+            break;
+          }
+        }
+      }
+      if (Clock::now() < nextFrame)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    } while (Clock::now() < nextFrame && !stopRequested);
+
+    auto now = Clock::now();
+    if (now - lastRate >= std::chrono::seconds(1))
+    {
+      recordsPerSecond = (dashboard.records - recordsAtLastRate) / std::chrono::duration<double>(now - lastRate).count();
+      recordsAtLastRate = dashboard.records;
+      lastRate = now;
+    }
+
+    if (resized)
+    {
+      resized = 0;
+      screen.invalidate();
+      for (Channel &c : dashboard.channels)
+      {
+        c.dirty = true;
+      }
+    }
+    render(dashboard, screen, recordsPerSecond);
+    frame++;
+    nextFrame += framePeriod;
+    if (nextFrame < now)
+    {
+      nextFrame = now + framePeriod;
+    }
+  }
+
+  screen.end();
+  return 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * Decoder for the serial output of the flowmeter firmware.
+ *
+ * Turns each line into a record: trace events with absolute device times, measurement starts,
+ * per-cycle and per-run results, and everything else as plain text.
+ */
+
+#ifndef DEVICE_DECODER_H
+#define DEVICE_DECODER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+struct DeviceRecord
+{
+  enum Type
+  {
+    TEXT,        // any other line
+    TRACE_BASE,  // "Trace: <micros>"
+    TRACE_EVENT, // "T<event> <delta> [value] [extra]", time is absolute
+    RUN_START,   // "Measurement starts with <seconds>s" or "... 10x <seconds>s"
+    CYCLE,       // "Cycle <n>: <pulses> pulses"
+    TIMESTAMP,   // "Timestamp: <micros>us"
+    GATE,        // "Gate: <micros>us"
+    PULSES,      // "Pulses: <count>"
+    WEIGHT,      // "Weight: <grams>g"
+    PROGRESS,    // "Time: <seconds>s Rate: <pulses>/s"
+    ABORTED,     // "Aborted: <pulses> pulses", the run was ended by the emergency stop
+    SYNC,        // "Sync: <token> <micros>", answer to a clock sync request, value is the token
+    INTERVAL,    // "Interval <micros>us: <count>", a bin of the pulse interval histogram
+  };
+
+  Type type = TEXT;
+  char event = 0;
+  uint64_t time = 0;
+  uint64_t value = 0;
+  uint64_t extra = 0;
+  double number = 0;
+};
+
+const char *const deviceRecordNames[] = {"TEXT",      "TRACE_BASE", "TRACE_EVENT", "RUN_START", "CYCLE", "TIMESTAMP",
+                                         "GATE",      "PULSES",     "WEIGHT",      "PROGRESS",  "ABORTED",
+                                         "SYNC",      "INTERVAL"};
+const int deviceRecordTypes = sizeof(deviceRecordNames) / sizeof(deviceRecordNames[0]);
+
+/**
+ * Returns the type with the given name, or TEXT for an unknown name.
+ */
+inline DeviceRecord::Type deviceRecordType(const char *name)
+{
+  for (int i = 0; i < deviceRecordTypes; i++)
+  {
+    if (std::strcmp(name, deviceRecordNames[i]) == 0)
+    {
+      return (DeviceRecord::Type)i;
+    }
+  }
+  return DeviceRecord::TEXT;
+}
+
+class DeviceDecoder
+{
+public:
+  /**
+   * Decodes one line without line ending.
+   */
+  DeviceRecord decode(const std::string &line)
+  {
+    DeviceRecord record;
+    const char *text = line.c_str();
+    unsigned long long a = 0, b = 0, c = 0;
+    char event = 0;
+    double number = 0;
+
+    if (std::sscanf(text, "Trace: %llu", &a) == 1)
+    {
+      traceTime = a;
+      traceStarted = true;
+      record.type = DeviceRecord::TRACE_BASE;
+      record.time = a;
+    }
+    else if (traceStarted && line.size() > 2 && line[0] == 'T' && line[2] == ' ' &&
+             std::sscanf(text, "T%c %llu %llu %llu", &event, &a, &b, &c) >= 2)
+    {
+      traceTime += a;
+      record.type = DeviceRecord::TRACE_EVENT;
+      record.event = event;
+      record.time = traceTime;
+      record.value = b;
+      record.extra = c;
+    }
+    else if (std::sscanf(text, "Splitted measurement starts with %llux %llus", &b, &a) == 2)
+    {
+      record.type = DeviceRecord::RUN_START;
+      record.value = a;
+      record.extra = b;
+    }
+    else if (std::sscanf(text, "Measurement starts with %llux %llus", &b, &a) == 2)
+    {
+      record.type = DeviceRecord::RUN_START;
+      record.value = a;
+      record.extra = b;
+    }
+    else if (std::sscanf(text, "Measurement starts with %llus", &a) == 1)
+    {
+      record.type = DeviceRecord::RUN_START;
+      record.value = a;
+      record.extra = 1;
+    }
+    else if (std::sscanf(text, "Cycle %llu: %llu pulses", &a, &b) == 2)
+    {
+      record.type = DeviceRecord::CYCLE;
+      record.value = a;
+      record.extra = b;
+    }
+    else if (std::sscanf(text, "Timestamp: %lluus", &a) == 1)
+    {
+      record.type = DeviceRecord::TIMESTAMP;
+      record.time = a;
+    }
+    else if (std::sscanf(text, "Gate: %lluus", &a) == 1)
+    {
+      record.type = DeviceRecord::GATE;
+      record.value = a;
+    }
+    else if (std::sscanf(text, "Pulses: %llu", &a) == 1)
+    {
+      record.type = DeviceRecord::PULSES;
+      record.value = a;
+    }
+    else if (std::sscanf(text, "Weight: %lfg", &number) == 1)
+    {
+      record.type = DeviceRecord::WEIGHT;
+      record.number = number;
+    }
+    else if (std::sscanf(text, "Time: %llus Rate: %llu/s", &a, &b) == 2)
+    {
+      record.type = DeviceRecord::PROGRESS;
+      record.value = a;
+      record.extra = b;
+    }
+    else if (std::sscanf(text, "Aborted: %llu pulses", &a) == 1)
+    {
+      record.type = DeviceRecord::ABORTED;
+      record.value = a;
+    }
+    else if (std::sscanf(text, "Sync: %llu %llu", &a, &b) == 2)
+    {
+      record.type = DeviceRecord::SYNC;
+      record.value = a;
+      record.time = b;
+    }
+    else if (std::sscanf(text, "Interval %lluus: %llu", &a, &b) == 2)
+    {
+      record.type = DeviceRecord::INTERVAL;
+      record.value = a;
+      record.extra = b;
+    }
+
+    return record;
+  }
+
+private:
+  uint64_t traceTime = 0;
+  bool traceStarted = false;
+};
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * Checks the serial log of the firmware in the native build.
+ *
+ * The log output goes into a pipe and is read back through the pulse stream decoder, like a host
+ * tool reads the board:
+ *
+ *   - a sync answer queued while a pulse frame is half sent comes after the frame, which decodes
+ *     with its pulses, and the lines after it are intact.
+ *
+ * Usage: log_test          exits with 1 if a check fails
+ */
+
+#include <Arduino.h>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "log.h"
+#include "pulse_stream.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  std::printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+  failures += !ok;
+}
+
+static uint8_t crc8(const uint8_t *data, size_t length)
+{
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/**
+ * Reads what the log sent so far.
+ */
+static std::string drain(int fd)
+{
+  std::string out;
+  char buffer[512];
+  ssize_t length;
+  while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    out.append(buffer, length);
+  }
+  return out;
+}
+
+static void syncDuringFrame(int fd)
+{
+  // three pulses 1000 us apart from 5000 us: L, count, start, first interval, difference 0
+  const uint8_t frame[] = {8, 3, 0x88, 0x13, 0x00, 0x00, 0xE8, 0x07, 0x00};
+  const uint8_t marker = 0x00;
+  uint8_t crc = crc8(frame, sizeof(frame));
+
+  logBytes(&marker, 1, false);
+  logFlush();
+  logLineFirst("Sync: 7 1234");
+  logBytes(frame, sizeof(frame), false);
+  logBytes(&crc, 1);
+  logLine("Pulses: 3");
+  logFlush();
+
+  PulseStream stream;
+  std::vector<std::string> lines;
+  std::vector<uint64_t> pulses;
+  std::string out = drain(fd);
+  stream.feed(
+      out.data(), out.size(), [&](const std::string &line) { lines.push_back(line); },
+      [&](uint64_t time) { pulses.push_back(time); });
+
+  check(stream.frames == 1 && stream.badFrames == 0, "frame decodes with the sync answer queued inside it");
+  check(pulses == std::vector<uint64_t>({5000, 6000, 7000}), "frame keeps its pulses");
+  check(lines == std::vector<std::string>({"Sync: 7 1234", "Pulses: 3"}), "sync answer and next line intact");
+}
+
+int main()
+{
+  int pipeFds[2];
+  if (pipe(pipeFds) != 0)
+  {
+    std::perror("pipe");
+    return 1;
+  }
+  fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+  Serial.attach(pipeFds[1]);
+
+  syncDuringFrame(pipeFds[0]);
+
+  std::printf("%d failures\n", failures);
+  return failures > 0 ? 1 : 0;
+}
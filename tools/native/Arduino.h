@@ -0,0 +1,129 @@
+/**
+ * Minimal Arduino API for the native build of the firmware.
+ *
+ * Provides just enough of String, Print and HardwareSerial for the portable firmware modules
+ * (measurement, scale, log, clock) to compile and run on the host. A HardwareSerial is backed by
+ * a file descriptor, so the firmware can talk to a pty or a pipe; without one, output is dropped
+ * and input is empty.
+ */
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#define HIGH 1
+#define LOW 0
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define pgm_read_float(address) (*(const float *)(address))
+
+// Interrupts are simulated synchronously on the host
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class String
+{
+public:
+  String(const char *text = "") : value(text) {}
+  String(const std::string &text) : value(text) {}
+  String(char c) : value(1, c) {}
+  String(int number) : value(std::to_string(number)) {}
+  String(unsigned int number) : value(std::to_string(number)) {}
+  String(long number) : value(std::to_string(number)) {}
+  String(unsigned long number) : value(std::to_string(number)) {}
+  String(double number, unsigned char decimalPlaces = 2)
+  {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimalPlaces, number);
+    value = buffer;
+  }
+
+  unsigned int length() const { return value.size(); }
+  const char *c_str() const { return value.c_str(); }
+  char operator[](unsigned int index) const { return index < value.size() ? value[index] : '\0'; }
+  bool operator==(const String &other) const { return value == other.value; }
+  bool operator!=(const String &other) const { return value != other.value; }
+  bool startsWith(const String &prefix) const { return value.compare(0, prefix.value.size(), prefix.value) == 0; }
+  long toInt() const { return strtol(value.c_str(), 0, 10); }
+  float toFloat() const { return strtof(value.c_str(), 0); }
+  bool reserve(unsigned int size)
+  {
+    value.reserve(size);
+    return true;
+  }
+
+  String &operator+=(const String &other)
+  {
+    value += other.value;
+    return *this;
+  }
+
+  friend String operator+(String left, const String &right) { return left += right; }
+  friend String operator+(String left, const char *right) { return left += String(right); }
+  friend String operator+(const char *left, const String &right) { return String(left) += right; }
+
+private:
+  std::string value;
+};
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual int availableForWrite() { return 0; }
+
+  size_t write(const char *text)
+  {
+    size_t length = strlen(text);
+    for (size_t i = 0; i < length; i++)
+    {
+      write((uint8_t)text[i]);
+    }
+    return length;
+  }
+
+  size_t print(const String &text) { return write(text.c_str()); }
+  size_t print(const char *text) { return write(text); }
+  size_t println(const String &text) { return print(text) + write("\r\n"); }
+  size_t println(const char *text) { return print(text) + write("\r\n"); }
+};
+
+class HardwareSerial : public Print
+{
+public:
+  explicit HardwareSerial(int fd = -1) : fd(fd) {}
+
+  /**
+   * Connects the port to a file descriptor, -1 disconnects it.
+   */
+  void attach(int descriptor) { fd = descriptor; }
+
+  void begin(unsigned long) {}
+  int available();
+  int read();
+  size_t write(uint8_t c) override;
+  int availableForWrite() override { return fd < 0 ? 0 : 4096; }
+  using Print::write;
+
+private:
+  int fd;
+  int peeked = -1;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
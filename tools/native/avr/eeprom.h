@@ -0,0 +1,35 @@
+/**
+ * EEPROM access of avr-libc for the native build: EEMEM variables are ordinary variables in RAM,
+ * so the EEPROM starts blank with every run.
+ */
+
+#ifndef NATIVE_AVR_EEPROM_H
+#define NATIVE_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+inline void eeprom_read_block(void *destination, const void *source, size_t size)
+{
+  memcpy(destination, source, size);
+}
+
+inline void eeprom_update_block(const void *source, void *destination, size_t size)
+{
+  memcpy(destination, source, size);
+}
+
+inline uint8_t eeprom_read_byte(const uint8_t *address)
+{
+  return *address;
+}
+
+inline void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+  *address = value;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include <Arduino.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+int HardwareSerial::available()
+{
+  if (peeked >= 0)
+  {
+    return 1;
+  }
+  if (fd < 0)
+  {
+    return 0;
+  }
+
+  pollfd descriptor = {fd, POLLIN, 0};
+  if (poll(&descriptor, 1, 0) <= 0 || !(descriptor.revents & POLLIN))
+  {
+    return 0;
+  }
+
+  uint8_t c;
+  if (::read(fd, &c, 1) != 1)
+  {
+    return 0;
+  }
+  peeked = c;
+  return 1;
+}
+
+int HardwareSerial::read()
+{
+  if (!available())
+  {
+    return -1;
+  }
+
+  int c = peeked;
+  peeked = -1;
+  return c;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (fd < 0)
+  {
+    return 1;
+  }
+  return ::write(fd, &c, 1) == 1 ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+/**
+ * ATOMIC_BLOCK of avr-libc for the native build, where interrupts are simulated synchronously.
+ */
+
+#ifndef NATIVE_UTIL_ATOMIC_H
+#define NATIVE_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (bool atomicOnce = true; atomicOnce; atomicOnce = false)
+
+#endif
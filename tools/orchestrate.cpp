@@ -0,0 +1,508 @@
+/**
+ * Runs a calibration campaign on all connected boards.
+ *
+ * The campaign file lists the jobs, one per line:
+ *
+ *   <meter> <flow> <seconds> <cycles> [repeats]
+ *
+ * meter and flow label the results; with --flow-command the flow is also sent to the board before
+ * the job (e.g. "flow %g" for sim_board). The jobs are kept in one queue and handed to the next
+ * board that is free, so the campaign time falls with the number of boards. A board is free once
+ * it has booted and its previous run reported its pulses (and weight). A run fails when the board
+ * resets, rejects the job, hangs up or does not finish within the expected time plus --timeout;
+ * failed jobs go back to the front of the queue up to --retries times. A run ended by the emergency
+ * stop of the board is not retried.
+ *
+ * All boards are served by one epoll loop. The results are written as tab-separated lines.
+ *
+ * Usage: orchestrate CAMPAIGN [PORT...] [--ports FILE] [--baud N] [--output FILE]
+ *                    [--retries N] [--timeout S] [--flow-command FORMAT]
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "board_port.h"
+
+const uint64_t bootMicros = 2500000;      // time for a board to come up after opening its port
+const uint64_t startMicros = 5000000;     // time for a board to accept a job
+const uint64_t weightMicros = 300000;     // time for the weight line after the pulses
+const uint64_t reopenMicros = 1000000;
+const uint64_t pauseMicros = 2000000;     // pause between cycles in the firmware
+
+struct Job
+{
+  std::string meter;
+  double flow = 0;
+  unsigned long seconds = 0;
+  unsigned long cycles = 0;
+  unsigned attempts = 0;
+};
+
+enum BoardState
+{
+  BOARD_OFFLINE,
+  BOARD_BOOTING,
+  BOARD_IDLE,
+  BOARD_STARTING,
+  BOARD_RUNNING,
+  BOARD_FINISHING
+};
+
+struct Board
+{
+  BoardPort port;
+  BoardState state = BOARD_OFFLINE;
+  uint64_t deadline = 0;
+  uint64_t jobStart = 0;
+  uint64_t busyMicros = 0;
+  Job job;
+  uint64_t pulses = 0;
+  uint64_t gateMicros = 0;
+  double weight = -1;
+  unsigned runs = 0;
+  unsigned failures = 0;
+};
+
+struct Campaign
+{
+  std::deque<Job> queue;
+  FILE *output = nullptr;
+  unsigned retries = 2;
+  double timeout = 70;
+  const char *flowCommand = nullptr;
+  unsigned done = 0;
+  unsigned failed = 0;
+  unsigned retried = 0;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+static bool readCampaign(const char *path, std::deque<Job> &queue)
+{
+  std::ifstream file(path);
+  if (!file)
+  {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+    std::istringstream fields(line);
+    Job job;
+    unsigned repeats = 1;
+    if (!(fields >> job.meter >> job.flow >> job.seconds >> job.cycles))
+    {
+      std::fprintf(stderr, "%s: bad job: %s\n", path, line.c_str());
+      return false;
+    }
+    fields >> repeats;
+    for (unsigned i = 0; i < repeats; i++)
+    {
+      queue.push_back(job);
+    }
+  }
+  return true;
+}
+
+static void sendLine(Board &board, const std::string &line)
+{
+  std::string text = line + "\n";
+  if (write(board.port.fd, text.data(), text.size()) != (ssize_t)text.size())
+  {
+    std::fprintf(stderr, "%s: write failed\n", board.port.path.c_str());
+  }
+}
+
+static void startJob(Board &board, Campaign &campaign, uint64_t now)
+{
+  board.job = campaign.queue.front();
+  campaign.queue.pop_front();
+  board.job.attempts++;
+  board.pulses = 0;
+  board.gateMicros = 0;
+  board.weight = -1;
+
+  if (campaign.flowCommand)
+  {
+    char command[64];
+    std::snprintf(command, sizeof(command), campaign.flowCommand, board.job.flow);
+    sendLine(board, command);
+  }
+  sendLine(board, "job " + std::to_string(board.job.seconds) + " " + std::to_string(board.job.cycles));
+
+  board.state = BOARD_STARTING;
+  board.jobStart = now;
+  board.deadline = now + startMicros;
+}
+
+static void failJob(Board &board, Campaign &campaign, const char *reason, uint64_t now, bool retry = true)
+{
+  std::fprintf(stderr, "board %u: %s %.3g l/min %lus x %lu attempt %u failed: %s\n", board.port.board,
+               board.job.meter.c_str(), board.job.flow, board.job.seconds, board.job.cycles, board.job.attempts, reason);
+  board.failures++;
+  board.busyMicros += now - board.jobStart;
+
+  if (retry && board.job.attempts <= campaign.retries)
+  {
+    campaign.queue.push_front(board.job);
+    campaign.retried++;
+  }
+  else
+  {
+    campaign.failed++;
+    std::fprintf(campaign.output, "%s\t%g\t%lu\t%lu\t%u\t%u\tfailed\t\t\t\t%s\n", board.job.meter.c_str(), board.job.flow,
+                 board.job.seconds, board.job.cycles, board.port.board, board.job.attempts, reason);
+  }
+}
+
+static void finishJob(Board &board, Campaign &campaign, uint64_t now)
+{
+  board.busyMicros += now - board.jobStart;
+  board.runs++;
+  campaign.done++;
+
+  char weight[32] = "";
+  if (board.weight >= 0)
+  {
+    std::snprintf(weight, sizeof(weight), "%.1f", board.weight);
+  }
+  std::fprintf(campaign.output, "%s\t%g\t%lu\t%lu\t%u\t%u\tok\t%llu\t%llu\t%s\t%.1f\n", board.job.meter.c_str(),
+               board.job.flow, board.job.seconds, board.job.cycles, board.port.board, board.job.attempts,
+               (unsigned long long)board.pulses, (unsigned long long)board.gateMicros, weight, (now - board.jobStart) / 1e6);
+  std::fflush(campaign.output);
+  board.state = BOARD_IDLE;
+}
+
+static bool busy(const Board &board)
+{
+  return board.state == BOARD_STARTING || board.state == BOARD_RUNNING || board.state == BOARD_FINISHING;
+}
+
+static void handleRecord(Board &board, Campaign &campaign, const DeviceRecord &record, const std::string &line,
+                         uint64_t now)
+{
+  if (board.state == BOARD_FINISHING)
+  {
+    // "Volume:", "Glitches:" and late pulse frames come between the pulses and the weight; a run
+    // without a scale is finished by the weightMicros deadline
+    if (record.type == DeviceRecord::WEIGHT)
+    {
+      board.weight = record.number;
+      finishJob(board, campaign, now);
+      return;
+    }
+    if (line.compare(0, 6, "Reset:") != 0)
+    {
+      return;
+    }
+    finishJob(board, campaign, now);
+  }
+
+  if (line.compare(0, 6, "Reset:") == 0)
+  {
+    if (busy(board))
+    {
+      failJob(board, campaign, "board reset", now);
+    }
+    board.state = BOARD_BOOTING;
+    board.deadline = now + bootMicros;
+    return;
+  }
+
+  switch (board.state)
+  {
+  case BOARD_BOOTING:
+    if (line.compare(0, 5, "Boot:") == 0)
+    {
+      board.state = BOARD_IDLE;
+    }
+    break;
+
+  case BOARD_STARTING:
+    if (record.type == DeviceRecord::RUN_START)
+    {
+      // the firmware pauses after every cycle of a split run, the last one included
+      double pauses = board.job.cycles > 1 ? board.job.cycles * pauseMicros / 1e6 : 0;
+      double expected = board.job.cycles * board.job.seconds + pauses;
+      board.state = BOARD_RUNNING;
+      board.deadline = now + (uint64_t)((expected + campaign.timeout) * 1e6);
+    }
+    else if (line == "Busy" || line.compare(0, 16, "Unknown command:") == 0)
+    {
+      failJob(board, campaign, line.c_str(), now);
+      board.state = BOARD_IDLE;
+    }
+    else if (line.compare(0, 10, "Usage: job") == 0)
+    {
+      // the board cannot run this profile, retrying does not help
+      failJob(board, campaign, line.c_str(), now, false);
+      board.state = BOARD_IDLE;
+    }
+    break;
+
+  case BOARD_RUNNING:
+    if (record.type == DeviceRecord::GATE)
+    {
+      board.gateMicros = record.value;
+    }
+    else if (record.type == DeviceRecord::ABORTED)
+    {
+      // somebody pressed the emergency stop, the campaign must not restart the run by itself
+      failJob(board, campaign, "emergency stop", now, false);
+      board.state = BOARD_IDLE;
+    }
+    else if (record.type == DeviceRecord::PULSES)
+    {
+      board.pulses = record.value;
+      board.state = BOARD_FINISHING;
+      board.deadline = now + weightMicros;
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+/**
+ * Handles the deadlines of the boards.
+ */
+static void checkDeadlines(int epoll, std::vector<Board> &boards, Campaign &campaign, uint64_t now)
+{
+  for (Board &board : boards)
+  {
+    if (board.state == BOARD_OFFLINE || now < board.deadline)
+    {
+      continue;
+    }
+
+    switch (board.state)
+    {
+    case BOARD_BOOTING:
+      board.state = BOARD_IDLE;
+      break;
+    case BOARD_FINISHING:
+      finishJob(board, campaign, now);
+      break;
+    case BOARD_STARTING:
+    case BOARD_RUNNING:
+      // the board does not answer; reopening the port resets a real board
+      failJob(board, campaign, "timeout", now);
+      closeBoardPort(epoll, board.port);
+      board.state = BOARD_OFFLINE;
+      board.deadline = now + reopenMicros;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Campaign campaign;
+  std::vector<std::string> specs;
+  int baud = 115200;
+  const char *outputPath = nullptr;
+  const char *campaignPath = nullptr;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+    {
+      baud = std::atoi(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      outputPath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--retries") == 0 && i + 1 < argc)
+    {
+      campaign.retries = std::atoi(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+    {
+      campaign.timeout = std::atof(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--flow-command") == 0 && i + 1 < argc)
+    {
+      campaign.flowCommand = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--ports") == 0 && i + 1 < argc)
+    {
+      std::ifstream list(argv[++i]);
+      std::string line;
+      while (std::getline(list, line))
+      {
+        if (!line.empty() && line[0] != '#')
+        {
+          specs.push_back(line);
+        }
+      }
+    }
+    else if (argv[i][0] != '-')
+    {
+      if (!campaignPath)
+      {
+        campaignPath = argv[i];
+      }
+      else
+      {
+        specs.push_back(argv[i]);
+      }
+    }
+    else
+    {
+      std::fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (!campaignPath || specs.empty())
+  {
+    std::fprintf(stderr, "usage: %s CAMPAIGN [PATH[:BOARD]...] [--ports FILE] [--baud N] [--output FILE]\n"
+                         "       [--retries N] [--timeout S] [--flow-command FORMAT]\n",
+                 argv[0]);
+    return 2;
+  }
+  if (!readCampaign(campaignPath, campaign.queue))
+  {
+    std::perror(campaignPath);
+    return 1;
+  }
+
+  campaign.output = outputPath ? std::fopen(outputPath, "w") : stdout;
+  if (!campaign.output)
+  {
+    std::perror(outputPath);
+    return 1;
+  }
+  std::fprintf(campaign.output, "# meter\tflow\tseconds\tcycles\tboard\tattempt\tstatus\tpulses\tgate_us\tweight_g\tduration_s\n");
+
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll < 0)
+  {
+    std::perror("epoll_create1");
+    return 1;
+  }
+
+  // the boards never move, epoll keeps pointers to their ports
+  std::vector<Board> boards(specs.size());
+  uint64_t started = hostMicros();
+  for (size_t i = 0; i < specs.size(); i++)
+  {
+    if (!parseBoardPort(specs[i], (uint16_t)i, boards[i].port))
+    {
+      std::fprintf(stderr, "bad port: %s\n", specs[i].c_str());
+      return 2;
+    }
+    boards[i].deadline = started;
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  size_t jobs = campaign.queue.size();
+  std::fprintf(stderr, "%zu jobs on %zu boards\n", jobs, boards.size());
+  std::vector<epoll_event> events(boards.size());
+
+  while (!stopRequested)
+  {
+    uint64_t now = hostMicros();
+
+    for (Board &board : boards)
+    {
+      if (board.state == BOARD_OFFLINE && now >= board.deadline)
+      {
+        if (openBoardPort(epoll, board.port, baud, &board))
+        {
+          board.state = BOARD_BOOTING;
+          board.deadline = now + bootMicros;
+        }
+        else
+        {
+          board.deadline = now + reopenMicros;
+        }
+      }
+    }
+
+    checkDeadlines(epoll, boards, campaign, now);
+
+    bool running = false;
+    for (Board &board : boards)
+    {
+      if (board.state == BOARD_IDLE && !campaign.queue.empty())
+      {
+        startJob(board, campaign, now);
+      }
+      running = running || busy(board);
+    }
+    if (!running && campaign.queue.empty())
+    {
+      break;
+    }
+
+    uint64_t next = UINT64_MAX;
+    for (const Board &board : boards)
+    {
+      if (board.state != BOARD_IDLE)
+      {
+        next = std::min(next, board.deadline);
+      }
+    }
+    int wait = next == UINT64_MAX ? 1000 : (int)std::min<uint64_t>(1000, (next > now ? next - now : 0) / 1000 + 1);
+
+    int ready = epoll_wait(epoll, events.data(), events.size(), wait);
+    now = hostMicros();
+    for (int i = 0; i < ready; i++)
+    {
+      Board &board = *(Board *)events[i].data.ptr;
+      auto handle = [&](uint64_t, const DeviceRecord &record, const std::string &line) {
+        handleRecord(board, campaign, record, line, now);
+      };
+      if (!drainBoardPort(board.port, handle) || (events[i].events & (EPOLLHUP | EPOLLERR)))
+      {
+        std::fprintf(stderr, "board %u: hung up\n", board.port.board);
+        if (busy(board))
+        {
+          failJob(board, campaign, "hung up", now);
+        }
+        closeBoardPort(epoll, board.port);
+        board.state = BOARD_OFFLINE;
+        board.deadline = now + reopenMicros;
+      }
+    }
+  }
+
+  double elapsed = (hostMicros() - started) / 1e6;
+  std::fprintf(stderr, "%u of %zu jobs done, %u failed, %u retries, %.1f s\n", campaign.done, jobs, campaign.failed,
+               campaign.retried, elapsed);
+  for (const Board &board : boards)
+  {
+    std::fprintf(stderr, "  board %u: %u runs, %u failures, busy %.0f%%\n", board.port.board, board.runs, board.failures,
+                 elapsed > 0 ? board.busyMicros / 1e4 / elapsed : 0);
+  }
+  if (campaign.output != stdout)
+  {
+    std::fclose(campaign.output);
+  }
+  return stopRequested || campaign.failed > 0 || !campaign.queue.empty() ? 1 : 0;
+}
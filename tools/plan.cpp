@@ -0,0 +1,336 @@
+/**
+ * Plans the measurement profile that reaches a target uncertainty in the least rig time.
+ *
+ * The variance of a cycle count is modelled as
+ *
+ *   var(s) = fixed + proportional * s
+ *
+ * where the fixed part comes from the valve lag and the count quantisation at the gate edges, and
+ * the proportional part from pressure variation during the gate. Both are fitted to the per-cycle
+ * counts of the split runs in one or more captures (runs of at least two different cycle lengths
+ * are needed to separate them; with one length the whole variance is taken as proportional), or
+ * given with --variance. The relative standard uncertainty of a profile of c cycles of s seconds is
+ *
+ *   u(s, c) = sqrt(var(s) / c) / (rate * s)
+ *
+ * and its rig time is c * (s + valve lag) + c * pause + run overhead, without the pauses for a
+ * single cycle: the firmware pauses after every cycle of a split run, the last one included. For
+ * every cycle length the fewest cycles that reach the target are taken and the profile with the
+ * shortest rig time wins. The profile is written as a job line ("job <seconds> <cycles>") that the firmware
+ * runs when it is sent to the serial port.
+ *
+ * Usage: plan [FILE...] --target PERCENT [--variance FIXED PROPORTIONAL] [--rate PULSES_PER_SECOND]
+ *             [--valve-lag S] [--pause S] [--run-overhead S] [--max-seconds N] [--max-cycles N]
+ *             [--output JOB_FILE] [--send PORT [--baud N]]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "capture_format.h"
+#include "serial_port.h"
+
+struct CostModel
+{
+  double valveLag = 0.13;        // seconds per cycle lost to opening and closing the valve
+  double pause = 2;              // seconds between two cycles, pauseMicros of the firmware
+  double runOverhead = 0;        // seconds per run for taring and weighing
+  unsigned long maxSeconds = 3600;
+  unsigned long maxCycles = 100;
+};
+
+struct VarianceModel
+{
+  double fixed = 0;              // pulses^2 per cycle
+  double proportional = 0;       // pulses^2 per second of gate time
+  double rate = 0;               // pulses per second
+};
+
+/**
+ * Pooled variance of the cycle counts of all split runs with the same cycle length.
+ */
+struct CycleGroup
+{
+  double squares = 0;            // sum of the squared deviations from the run means
+  double freedom = 0;            // degrees of freedom
+  double pulses = 0;
+  double cycles = 0;
+};
+
+static bool collectCycles(const char *path, std::map<unsigned long, CycleGroup> &groups)
+{
+  CaptureReader reader;
+  std::string error;
+  if (!reader.open(path, error))
+  {
+    std::fprintf(stderr, "%s: %s\n", path, error.c_str());
+    return false;
+  }
+
+  for (uint32_t i = 0; i < reader.runCount(); i++)
+  {
+    const CaptureRun &run = reader.run(i);
+    if (run.cycleCount < 2 || run.seconds == 0)
+    {
+      continue;
+    }
+
+    const uint32_t *cycles = reader.cycles(run);
+    double sum = 0;
+    for (uint32_t c = 0; c < run.cycleCount; c++)
+    {
+      sum += cycles[c];
+    }
+    double mean = sum / run.cycleCount;
+
+    CycleGroup &group = groups[run.seconds];
+    for (uint32_t c = 0; c < run.cycleCount; c++)
+    {
+      group.squares += (cycles[c] - mean) * (cycles[c] - mean);
+    }
+    group.freedom += run.cycleCount - 1;
+    group.pulses += sum;
+    group.cycles += run.cycleCount;
+  }
+  return true;
+}
+
+/**
+ * Fits var(s) = fixed + proportional * s by weighted least squares over the cycle lengths.
+ */
+static VarianceModel fitVariance(const std::map<unsigned long, CycleGroup> &groups)
+{
+  VarianceModel model;
+  double w = 0, ws = 0, wss = 0, wv = 0, wsv = 0, pulses = 0, seconds = 0;
+  for (const auto &entry : groups)
+  {
+    double s = entry.first;
+    const CycleGroup &group = entry.second;
+    double variance = group.squares / group.freedom;
+    std::printf("  %4lus cycles: %5.0f cycles, mean %10.1f pulses, sd %8.3f pulses\n", entry.first, group.cycles,
+                group.pulses / group.cycles, std::sqrt(variance));
+
+    w += group.freedom;
+    ws += group.freedom * s;
+    wss += group.freedom * s * s;
+    wv += group.freedom * variance;
+    wsv += group.freedom * s * variance;
+    pulses += group.pulses;
+    seconds += group.cycles * s;
+  }
+
+  double determinant = w * wss - ws * ws;
+  if (groups.size() >= 2 && determinant > 0)
+  {
+    model.proportional = (w * wsv - ws * wv) / determinant;
+    model.fixed = (wv - model.proportional * ws) / w;
+  }
+  if (groups.size() < 2 || model.fixed < 0 || model.proportional < 0)
+  {
+    // not separable: take the whole variance as proportional to the gate time
+    model.fixed = 0;
+    model.proportional = wv / ws;
+  }
+  model.rate = pulses / seconds;
+  return model;
+}
+
+static double uncertainty(const VarianceModel &model, double seconds, double cycles)
+{
+  return std::sqrt((model.fixed + model.proportional * seconds) / cycles) / (model.rate * seconds);
+}
+
+static double rigTime(const CostModel &cost, double seconds, double cycles)
+{
+  double pauses = cycles > 1 ? cycles * cost.pause : 0;
+  return cycles * (seconds + cost.valveLag) + pauses + cost.runOverhead;
+}
+
+static void printProfile(const char *name, const VarianceModel &model, const CostModel &cost, unsigned long seconds,
+                         unsigned long cycles)
+{
+  std::printf("  %-10s %4lus x %3lu  u %.4f%%  rig time %7.1fs\n", name, seconds, cycles,
+              uncertainty(model, seconds, cycles) * 100, rigTime(cost, seconds, cycles));
+}
+
+static bool parseOption(const char *name, int &i, int argc, char **argv, double &value)
+{
+  if (std::strcmp(argv[i], name) != 0 || i + 1 >= argc)
+  {
+    return false;
+  }
+  value = std::atof(argv[++i]);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  CostModel cost;
+  VarianceModel model;
+  std::vector<const char *> paths;
+  double target = 0;
+  double rate = 0;
+  double maxSeconds = cost.maxSeconds;
+  double maxCycles = cost.maxCycles;
+  double baud = 115200;
+  bool givenVariance = false;
+  const char *output = nullptr;
+  const char *port = nullptr;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (argv[i][0] != '-')
+    {
+      paths.push_back(argv[i]);
+    }
+    else if (std::strcmp(argv[i], "--variance") == 0 && i + 2 < argc)
+    {
+      model.fixed = std::atof(argv[i + 1]);
+      model.proportional = std::atof(argv[i + 2]);
+      givenVariance = true;
+      i += 2;
+    }
+    else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      output = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--send") == 0 && i + 1 < argc)
+    {
+      port = argv[++i];
+    }
+    else if (!parseOption("--target", i, argc, argv, target) &&
+             !parseOption("--rate", i, argc, argv, rate) &&
+             !parseOption("--valve-lag", i, argc, argv, cost.valveLag) &&
+             !parseOption("--pause", i, argc, argv, cost.pause) &&
+             !parseOption("--run-overhead", i, argc, argv, cost.runOverhead) &&
+             !parseOption("--max-seconds", i, argc, argv, maxSeconds) &&
+             !parseOption("--max-cycles", i, argc, argv, maxCycles) &&
+             !parseOption("--baud", i, argc, argv, baud))
+    {
+      std::fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 2;
+    }
+  }
+  cost.maxSeconds = (unsigned long)maxSeconds;
+  cost.maxCycles = (unsigned long)maxCycles;
+
+  if (target <= 0 || (paths.empty() && !(givenVariance && rate > 0)))
+  {
+    std::fprintf(stderr, "usage: %s [FILE...] --target PERCENT [--variance FIXED PROPORTIONAL] [--rate PULSES_PER_SECOND]\n"
+                         "       [--valve-lag S] [--pause S] [--run-overhead S] [--max-seconds N] [--max-cycles N]\n"
+                         "       [--output JOB_FILE] [--send PORT [--baud N]]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  if (!paths.empty())
+  {
+    std::map<unsigned long, CycleGroup> groups;
+    for (const char *path : paths)
+    {
+      if (!collectCycles(path, groups))
+      {
+        return 1;
+      }
+    }
+    if (groups.empty())
+    {
+      std::fprintf(stderr, "no split runs in the captures\n");
+      return 1;
+    }
+
+    std::printf("Per-cycle counts of the split runs\n");
+    VarianceModel fitted = fitVariance(groups);
+    if (!givenVariance)
+    {
+      model.fixed = fitted.fixed;
+      model.proportional = fitted.proportional;
+    }
+    if (rate <= 0)
+    {
+      rate = fitted.rate;
+    }
+  }
+  model.rate = rate;
+
+  std::printf("Model: var = %.3f + %.4f * s pulses^2, rate %.2f pulses/s, valve lag %.3fs, pause %.1fs\n",
+              model.fixed, model.proportional, model.rate, cost.valveLag, cost.pause);
+
+  double limit = target / 100;
+  unsigned long bestSeconds = 0, bestCycles = 0;
+  double bestTime = INFINITY;
+  for (unsigned long seconds = 1; seconds <= cost.maxSeconds; seconds++)
+  {
+    double needed = (model.fixed + model.proportional * seconds) / std::pow(limit * model.rate * seconds, 2);
+    unsigned long cycles = std::max(1.0, std::ceil(needed - 1e-9));
+    if (cycles > cost.maxCycles)
+    {
+      continue;
+    }
+    double time = rigTime(cost, seconds, cycles);
+    if (time < bestTime)
+    {
+      bestTime = time;
+      bestSeconds = seconds;
+      bestCycles = cycles;
+    }
+  }
+
+  std::printf("Profiles of the buttons\n");
+  printProfile("button", model, cost, 1, 10);
+  printProfile("button", model, cost, 3, 10);
+  printProfile("button", model, cost, 10, 1);
+  printProfile("button", model, cost, 100, 1);
+
+  if (bestCycles == 0)
+  {
+    std::printf("No profile within %lus x %lu reaches %.4f%%\n", cost.maxSeconds, cost.maxCycles, target);
+    return 1;
+  }
+  std::printf("Best profile for %.4f%%\n", target);
+  printProfile("planned", model, cost, bestSeconds, bestCycles);
+
+  char job[32];
+  int length = std::snprintf(job, sizeof(job), "job %lu %lu\n", bestSeconds, bestCycles);
+
+  if (output)
+  {
+    FILE *file = std::fopen(output, "w");
+    if (!file || std::fputs(job, file) < 0 || std::fclose(file) != 0)
+    {
+      std::perror(output);
+      return 1;
+    }
+  }
+
+  if (port)
+  {
+    int fd = openSerialPort(port, (int)baud);
+    if (fd < 0)
+    {
+      std::perror(port);
+      return 1;
+    }
+    // opening the USB port resets the board; give the bootloader time to hand over
+    sleep(2);
+    if (write(fd, job, length) != length)
+    {
+      std::perror("write");
+      return 1;
+    }
+    close(fd);
+    std::printf("Sent to %s: %s", port, job);
+  }
+  else if (!output)
+  {
+    std::printf("%s", job);
+  }
+  return 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * Decoder for the pulse stream of the flowmeter firmware ("trace stream").
+ *
+ * The serial output then mixes text lines with binary frames of pulses. A frame starts where a
+ * line would start, with the byte 0x00, followed by the length L, the number of pulses, the time
+ * of the first pulse (low 32 bits of the device clock in microseconds, little endian), the LEB128
+ * varints of the first interval and of the zigzag encoded differences of the following intervals,
+ * and a CRC-8 (polynomial 0x07) over L and the L bytes after it.
+ *
+ * Every reader of the serial output has to go through the decoder while the stream may be on,
+ * else the frames end up inside the next text line. DeviceReader does that for the readers of
+ * decoded records.
+ */
+
+#ifndef PULSE_STREAM_H
+#define PULSE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "device_decoder.h"
+
+class PulseStream
+{
+public:
+  uint64_t frames = 0;
+  uint64_t badFrames = 0;
+  uint64_t pulses = 0;
+  uint64_t frameBytes = 0; // including marker and checksum
+  uint64_t longLines = 0;
+  size_t lineLimit = 0; // longer text lines are passed on in pieces; 0 for no limit
+
+  /**
+   * Sets the device time the 32-bit frame times are unwrapped against. The frame times are only
+   * unique within 35.8 minutes of it, so it should follow the device clock: each frame moves it to
+   * its last pulse, and the caller sets it from every line with a current device time (trace
+   * base and events, sync answers).
+   */
+  void setReference(uint64_t micros)
+  {
+    reference = micros;
+  }
+
+  /**
+   * Drops a partial line or frame, e.g. when the port was closed.
+   */
+  void clear()
+  {
+    state = TEXT;
+    text.clear();
+  }
+
+  /**
+   * Feeds bytes of the serial output. Calls line(text) for every text line, without line ending,
+   * and pulse(micros) for every pulse of a valid frame, with its absolute device time.
+   */
+  template <typename LineHandler, typename PulseHandler>
+  void feed(const char *data, size_t length, LineHandler line, PulseHandler pulse)
+  {
+    for (size_t i = 0; i < length; i++)
+    {
+      uint8_t byte = (uint8_t)data[i];
+      switch (state)
+      {
+      case TEXT:
+        if (byte == frameMarker && text.empty())
+        {
+          state = LENGTH;
+        }
+        else if (byte == '\n')
+        {
+          line(text);
+          text.clear();
+        }
+        else if (byte != '\r')
+        {
+          text += (char)byte;
+          if (lineLimit > 0 && text.size() >= lineLimit)
+          {
+            longLines++;
+            line(text);
+            text.clear();
+          }
+        }
+        break;
+
+      case LENGTH:
+        frame.assign(1, byte);
+        state = byte < headerLength ? TEXT : BODY;
+        badFrames += state == TEXT;
+        break;
+
+      case BODY:
+        frame.push_back(byte);
+        if (frame.size() == (size_t)frame[0] + 1)
+        {
+          state = CHECKSUM;
+        }
+        break;
+
+      case CHECKSUM:
+        state = TEXT;
+        if (crc(frame) != byte || !decodeFrame())
+        {
+          badFrames++;
+          break;
+        }
+        frames++;
+        frameBytes += frame.size() + 2;
+        pulses += times.size();
+        for (uint64_t time : times)
+        {
+          pulse(time);
+        }
+        break;
+      }
+    }
+  }
+
+private:
+  enum State
+  {
+    TEXT,
+    LENGTH,
+    BODY,
+    CHECKSUM,
+  };
+
+  static const uint8_t frameMarker = 0x00;
+  static const uint8_t headerLength = 5; // pulse count and time after the length byte
+
+  State state = TEXT;
+  std::string text;
+  std::vector<uint8_t> frame;
+  std::vector<uint64_t> times;
+  uint64_t reference = 0;
+
+  static uint8_t crc(const std::vector<uint8_t> &bytes)
+  {
+    uint8_t crc = 0;
+    for (uint8_t byte : bytes)
+    {
+      crc ^= byte;
+      for (int bit = 0; bit < 8; bit++)
+      {
+        crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+      }
+    }
+    return crc;
+  }
+
+  /**
+   * Reads a varint at position, returns false if it runs past the frame.
+   */
+  bool readVarint(size_t &position, uint32_t &value) const
+  {
+    value = 0;
+    for (int shift = 0; shift < 35 && position < frame.size(); shift += 7)
+    {
+      uint8_t byte = frame[position++];
+      value |= (uint32_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Turns the frame into absolute pulse times; false if the varints do not match the count.
+   */
+  bool decodeFrame()
+  {
+    times.clear();
+    unsigned count = frame[1];
+    uint32_t start = frame[2] | (uint32_t)frame[3] << 8 | (uint32_t)frame[4] << 16 | (uint32_t)frame[5] << 24;
+    uint64_t time = reference + (int64_t)(int32_t)(start - (uint32_t)reference);
+
+    size_t position = 1 + headerLength;
+    uint32_t interval = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+      if (i > 0)
+      {
+        uint32_t code;
+        if (!readVarint(position, code))
+        {
+          return false;
+        }
+        int32_t difference = (int32_t)(code >> 1) ^ -(int32_t)(code & 1);
+        interval = i == 1 ? code : interval + difference;
+        time += interval;
+      }
+      times.push_back(time);
+    }
+    if (count == 0 || position != frame.size())
+    {
+      return false;
+    }
+    reference = time;
+    return true;
+  }
+};
+
+/**
+ * Turns the serial output of a board into decoded records: text lines through DeviceDecoder and
+ * the pulses of the frames as TRACE_EVENT records of event 'P' with the line "TP", like pulses
+ * traced as lines. Empty lines are skipped.
+ */
+class DeviceReader
+{
+public:
+  DeviceDecoder decoder;
+  PulseStream stream;
+  uint64_t lines = 0;
+
+  /**
+   * Feeds bytes of the serial output and calls handle(record, line) for every record.
+   */
+  template <typename Handler>
+  void feed(const char *data, size_t length, Handler handle)
+  {
+    stream.feed(
+        data, length,
+        [&](const std::string &line) {
+          if (line.empty())
+          {
+            return;
+          }
+          DeviceRecord record = decoder.decode(line);
+          if (record.type == DeviceRecord::TRACE_BASE || record.type == DeviceRecord::TRACE_EVENT ||
+              record.type == DeviceRecord::SYNC)
+          {
+            stream.setReference(record.time);
+          }
+          lines++;
+          handle(record, line);
+        },
+        [&](uint64_t time) {
+          DeviceRecord record;
+          record.type = DeviceRecord::TRACE_EVENT;
+          record.event = 'P';
+          record.time = time;
+          handle(record, pulseLine);
+        });
+  }
+
+private:
+  const std::string pulseLine = "TP";
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "rig_model.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "board.h"
+#include "clock.h"
+#include "measurement.h"
+
+Rig *rig = 0;
+
+void setValve(bool open)
+{
+  rig->valveCommand = open;
+  rig->valveCommandTime = rig->now;
+}
+
+void writeToDisplay(const String, const int)
+{
+}
+
+double pulseVolume(Rig &state)
+{
+  std::normal_distribution<double> jitter(1, state.model.pulseJitter);
+  return std::max(0.1, jitter(state.random)) / state.model.kFactor;
+}
+
+void advance(Rig &state, uint64_t micros)
+{
+  const RigModel &model = state.model;
+  double dt = micros * 1e-6;
+  double t = state.now * 1e-6;
+
+  // the valve moves after its lag, at the ramp rate
+  double lag = state.valveCommand ? model.openLag : model.closeLag;
+  if (state.now >= state.valveCommandTime + (uint64_t)(lag * 1e6))
+  {
+    double step = model.ramp > 0 ? dt / model.ramp : 1;
+    state.opening = state.valveCommand ? std::min(1.0, state.opening + step) : std::max(0.0, state.opening - step);
+  }
+
+  // flow grows with the square root of the pressure
+  double pressure = state.pressure * (1 + model.ripple * std::sin(2 * M_PI * model.rippleFrequency * t + state.ripplePhase));
+  double flow = model.flow / 60 * std::sqrt(std::max(0.0, pressure)) * state.opening;
+  double volume = flow * dt;
+
+  state.passedVolume += volume;
+  state.meterVolume += volume;
+  while (state.meterVolume >= state.nextPulseVolume)
+  {
+    state.meterVolume -= state.nextPulseVolume;
+    state.nextPulseVolume = pulseVolume(state);
+    countPulse();
+  }
+
+  if (model.glitchRate > 0)
+  {
+    std::poisson_distribution<int> glitches(model.glitchRate * dt);
+    for (int i = glitches(state.random); i > 0; i--)
+    {
+      countPulse();
+    }
+  }
+
+  state.now += micros;
+  clockSetMicros(state.now);
+}
@@ -0,0 +1,66 @@
+/**
+ * Physical model of the rig for the native build of the firmware.
+ *
+ * The valve opens and closes with a lag and a flow ramp, the supply pressure drifts between runs
+ * and pulsates within a run, and the meter turns volume into pulses with a K-factor, per-pulse
+ * jitter and spurious glitches. rig_model.cpp implements the board hooks of board.h on the rig
+ * set in rig, so a tool linked with it runs the measurement code against the rig.
+ */
+
+#ifndef RIG_MODEL_H
+#define RIG_MODEL_H
+
+#include <Arduino.h>
+
+#include <random>
+
+struct RigModel
+{
+  double kFactor = 450;           // pulses per litre
+  double flow = 10;               // litres per minute at nominal pressure
+  double openLag = 0.050;         // seconds from the valve command until the flow starts
+  double closeLag = 0.080;        // seconds from the valve command until the flow decreases
+  double ramp = 0.030;            // seconds for the flow to go from zero to full and back
+  double ripple = 0.02;           // relative pressure amplitude of the pump pulsation
+  double rippleFrequency = 7;     // Hz
+  double drift = 0.01;            // relative standard deviation of the pressure between runs
+  double pulseJitter = 0.01;      // relative standard deviation of the volume per pulse
+  double glitchRate = 0;          // spurious pulses per second
+  double loopMin = 20e-6;         // shortest loop() pass in seconds
+  double loopMax = 300e-6;        // longest loop() pass in seconds
+};
+
+/**
+ * State of the simulated hardware between two loop() passes.
+ */
+struct Rig
+{
+  RigModel model;
+  std::mt19937_64 random;
+  uint64_t now = 0;
+
+  bool valveCommand = false;
+  uint64_t valveCommandTime = 0;
+  double opening = 0;
+
+  double pressure = 1;
+  double ripplePhase = 0;
+  double meterVolume = 0;
+  double nextPulseVolume = 0;
+  double passedVolume = 0;
+};
+
+// The rig the board hooks act on
+extern Rig *rig;
+
+/**
+ * Draws the volume of the next pulse of the meter.
+ */
+double pulseVolume(Rig &state);
+
+/**
+ * Moves the rig forward by a number of microseconds and fires the pulse interrupt.
+ */
+void advance(Rig &state, uint64_t micros);
+
+#endif
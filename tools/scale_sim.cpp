@@ -0,0 +1,198 @@
+/**
+ * Simulated serial scale on a pseudo terminal.
+ *
+ * Prints the path of the pty and sends readings in the "ST,GS,+0001234.50 g" format, either
+ * continuously or when a "Q" request arrives. Commands on stdin change the weight:
+ *
+ *   fill <grams> <seconds>   add water at a constant rate, unstable while filling
+ *   set <grams>              put a weight on the scale
+ *   empty                    empty the bucket
+ *
+ * Usage: scale_sim [--on-request] [--period ms] [--noise grams]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Scale
+{
+  double weight = 0;
+  double fillRate = 0;
+  Clock::time_point fillEnd;
+};
+
+static double secondsSince(Clock::time_point start, Clock::time_point end)
+{
+  return std::chrono::duration<double>(end - start).count();
+}
+
+static void handleCommand(Scale &scale, const std::string &line)
+{
+  double grams = 0;
+  double seconds = 0;
+
+  if (std::sscanf(line.c_str(), "fill %lf %lf", &grams, &seconds) == 2 && seconds > 0)
+  {
+    scale.fillRate = grams / seconds;
+    scale.fillEnd = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  }
+  else if (std::sscanf(line.c_str(), "set %lf", &grams) == 1)
+  {
+    scale.weight = grams;
+  }
+  else if (line == "empty")
+  {
+    scale.weight = 0;
+  }
+  else
+  {
+    std::fprintf(stderr, "unknown command: %s\n", line.c_str());
+  }
+}
+
+static void sendReading(int fd, const Scale &scale, double noise, std::mt19937 &random)
+{
+  std::normal_distribution<double> jitter(0, noise);
+  bool filling = scale.fillRate != 0;
+  double reading = scale.weight + (noise > 0 ? jitter(random) : 0);
+
+  char line[64];
+  int length = std::snprintf(line, sizeof(line), "%s,GS,%+011.2f g\r\n", filling ? "US" : "ST", reading);
+  if (write(fd, line, length) != length)
+  {
+    std::perror("write");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bool onRequest = false;
+  int periodMs = 100;
+  double noise = 0.05;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--on-request") == 0)
+    {
+      onRequest = true;
+    }
+    else if (std::strcmp(argv[i], "--period") == 0 && i + 1 < argc)
+    {
+      periodMs = std::atoi(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--noise") == 0 && i + 1 < argc)
+    {
+      noise = std::atof(argv[++i]);
+    }
+    else
+    {
+      std::fprintf(stderr, "usage: %s [--on-request] [--period ms] [--noise grams]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+  {
+    std::perror("pty");
+    return 1;
+  }
+
+  termios settings;
+  tcgetattr(master, &settings);
+  cfmakeraw(&settings);
+  tcsetattr(master, TCSANOW, &settings);
+
+  std::printf("%s\n", ptsname(master));
+  std::fflush(stdout);
+
+  Scale scale;
+  std::mt19937 random(1);
+  std::string command;
+  std::string request;
+  Clock::time_point last = Clock::now();
+  Clock::time_point nextReading = last;
+
+  while (true)
+  {
+    pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {master, POLLIN, 0}};
+    if (poll(fds, 2, 10) < 0)
+    {
+      std::perror("poll");
+      return 1;
+    }
+
+    char buffer[256];
+    if (fds[0].revents & (POLLIN | POLLHUP))
+    {
+      ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+      if (length <= 0)
+      {
+        return 0;
+      }
+      for (ssize_t i = 0; i < length; i++)
+      {
+        if (buffer[i] == '\n')
+        {
+          handleCommand(scale, command);
+          command.clear();
+        }
+        else
+        {
+          command += buffer[i];
+        }
+      }
+    }
+
+    // without a reader on the slave side, reads fail with EIO; keep waiting for one
+    bool requested = false;
+    if (fds[1].revents & POLLIN)
+    {
+      ssize_t length = read(master, buffer, sizeof(buffer));
+      for (ssize_t i = 0; i < length; i++)
+      {
+        if (buffer[i] == '\r' || buffer[i] == '\n')
+        {
+          requested = requested || request == "Q";
+          request.clear();
+        }
+        else
+        {
+          request += buffer[i];
+        }
+      }
+    }
+    else if (fds[1].revents & POLLHUP)
+    {
+      usleep(10000);
+    }
+
+    Clock::time_point now = Clock::now();
+    if (scale.fillRate != 0)
+    {
+      Clock::time_point end = now < scale.fillEnd ? now : scale.fillEnd;
+      scale.weight += scale.fillRate * secondsSince(last, end);
+      if (now >= scale.fillEnd)
+      {
+        scale.fillRate = 0;
+      }
+    }
+    last = now;
+
+    if (onRequest ? requested : now >= nextReading)
+    {
+      sendReading(master, scale, noise, random);
+      nextReading = now + std::chrono::milliseconds(periodMs);
+    }
+  }
+}
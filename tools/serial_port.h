@@ -0,0 +1,71 @@
+/**
+ * Opens a serial port of a board, or a pty standing in for one, in raw mode.
+ */
+
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * Returns the termios speed constant of a baud rate, B0 for unsupported rates.
+ */
+inline speed_t serialSpeed(int baud)
+{
+  switch (baud)
+  {
+  case 9600:
+    return B9600;
+  case 19200:
+    return B19200;
+  case 38400:
+    return B38400;
+  case 57600:
+    return B57600;
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+  default:
+    return B0;
+  }
+}
+
+/**
+ * Opens the port for reading and writing, 8N1 without flow control.
+ *
+ * Returns the file descriptor or -1 with errno set. With nonBlocking, reads return EAGAIN
+ * instead of waiting.
+ */
+inline int openSerialPort(const char *path, int baud, bool nonBlocking = false)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY | (nonBlocking ? O_NONBLOCK : 0));
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  termios settings;
+  if (tcgetattr(fd, &settings) == 0)
+  {
+    cfmakeraw(&settings);
+    settings.c_cflag |= CLOCAL | CREAD;
+    settings.c_cflag &= ~CRTSCTS;
+    settings.c_cc[VMIN] = 1;
+    settings.c_cc[VTIME] = 0;
+
+    speed_t speed = serialSpeed(baud);
+    if (speed != B0)
+    {
+      cfsetispeed(&settings, speed);
+      cfsetospeed(&settings, speed);
+    }
+    tcsetattr(fd, TCSANOW, &settings);
+  }
+
+  return fd;
+}
+
+#endif
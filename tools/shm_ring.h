@@ -0,0 +1,279 @@
+/**
+ * Shared-memory ring of decoded records, one writer and any number of readers.
+ *
+ * The writer (capture_daemon --shm) maps a POSIX shared memory object and writes every record into
+ * the next fixed-size slot, overwriting the oldest one; it never waits for readers and never reads
+ * anything they write, so readers cannot slow it down. Readers map the object read-only, keep
+ * their own position and read the records in place.
+ *
+ * Every slot carries the sequence number of its record as a seqlock: odd while the writer fills
+ * the slot, even when the record is complete. A reader checks the sequence before and after using
+ * a record; if the writer has lapped the reader in between, the record is dropped and counted as
+ * lost for that reader only.
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "device_decoder.h"
+
+const char shmRingMagic[8] = {'F', 'L', 'O', 'W', 'R', 'I', 'N', 'G'};
+const uint32_t shmRingVersion = 2;
+
+struct alignas(64) ShmRingHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t slotSize;
+  uint64_t capacity;                   // number of slots, a power of two
+  std::atomic<uint64_t> head;          // number of records published
+};
+
+struct alignas(64) ShmRecord
+{
+  std::atomic<uint64_t> sequence;      // 2 * (record number + 1) when complete, odd while written
+  uint64_t hostMicros;
+  uint64_t time;
+  uint64_t hostTime;                   // time on the host clock, 0 when not synchronised
+  uint64_t value;
+  uint64_t extra;
+  double number;
+  uint16_t board;
+  uint16_t channel;
+  uint8_t type;                        // DeviceRecord::Type
+  char event;
+  uint16_t length;
+  char line[192];
+};
+static_assert(sizeof(ShmRecord) == 256, "slot layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the sequence must be lock-free in shared memory");
+
+inline size_t shmRingSize(uint64_t capacity)
+{
+  return sizeof(ShmRingHeader) + capacity * sizeof(ShmRecord);
+}
+
+class ShmRingWriter
+{
+public:
+  ~ShmRingWriter() { close(); }
+
+  /**
+   * Creates (or replaces) the shared memory object with capacity slots, rounded up to a power of two.
+   */
+  bool open(const char *ringName, uint64_t capacity, std::string &error)
+  {
+    uint64_t slots = 1;
+    while (slots < capacity)
+    {
+      slots <<= 1;
+    }
+
+    name = ringName;
+    int fd = shm_open(ringName, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, shmRingSize(slots)) != 0)
+    {
+      error = std::strerror(errno);
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+      return false;
+    }
+
+    size = shmRingSize(slots);
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+      error = std::strerror(errno);
+      return false;
+    }
+
+    // a fresh object is zero-filled: every slot sequence is 0, no record is complete
+    header = (ShmRingHeader *)map;
+    records = (ShmRecord *)(header + 1);
+    std::memcpy(header->magic, shmRingMagic, sizeof(shmRingMagic));
+    header->version = shmRingVersion;
+    header->slotSize = sizeof(ShmRecord);
+    header->capacity = slots;
+    header->head.store(0, std::memory_order_release);
+    return true;
+  }
+
+  void publish(uint64_t hostMicros, uint16_t board, uint16_t channel, const DeviceRecord &record, uint64_t hostTime,
+               const char *line, size_t length)
+  {
+    uint64_t number = header->head.load(std::memory_order_relaxed);
+    ShmRecord &slot = records[number & (header->capacity - 1)];
+
+    slot.sequence.store(2 * number + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.hostMicros = hostMicros;
+    slot.time = record.time;
+    slot.hostTime = hostTime;
+    slot.value = record.value;
+    slot.extra = record.extra;
+    slot.number = record.number;
+    slot.board = board;
+    slot.channel = channel;
+    slot.type = record.type;
+    slot.event = record.event;
+    slot.length = length < sizeof(slot.line) ? length : sizeof(slot.line);
+    std::memcpy(slot.line, line, slot.length);
+
+    slot.sequence.store(2 * (number + 1), std::memory_order_release);
+    header->head.store(number + 1, std::memory_order_release);
+  }
+
+  void close()
+  {
+    if (header)
+    {
+      munmap(header, size);
+      shm_unlink(name.c_str());
+      header = nullptr;
+    }
+  }
+
+private:
+  std::string name;
+  ShmRingHeader *header = nullptr;
+  ShmRecord *records = nullptr;
+  size_t size = 0;
+};
+
+class ShmRingReader
+{
+public:
+  ~ShmRingReader()
+  {
+    if (header)
+    {
+      munmap(const_cast<ShmRingHeader *>(header), size);
+    }
+  }
+
+  /**
+   * Maps the ring read-only. Reading starts with the next record published, or with the oldest
+   * record still in the ring.
+   */
+  bool open(const char *ringName, bool fromOldest, std::string &error)
+  {
+    int fd = shm_open(ringName, O_RDONLY, 0);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ShmRingHeader))
+    {
+      error = fd < 0 ? std::strerror(errno) : "not a ring";
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+      return false;
+    }
+
+    size = info.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+      error = std::strerror(errno);
+      return false;
+    }
+    header = (const ShmRingHeader *)map;
+    records = (const ShmRecord *)(header + 1);
+
+    if (std::memcmp(header->magic, shmRingMagic, sizeof(shmRingMagic)) != 0 || header->version != shmRingVersion ||
+        header->slotSize != sizeof(ShmRecord) || shmRingSize(header->capacity) > size)
+    {
+      error = "not a ring of this version";
+      return false;
+    }
+
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    position = head;
+    if (fromOldest)
+    {
+      position = head > header->capacity ? head - header->capacity : 0;
+    }
+    return true;
+  }
+
+  /**
+   * Returns the next record in place, or nullptr if the writer has not published one yet. The
+   * record stays valid until the next call of next(), if stillValid() confirms it after use.
+   */
+  const ShmRecord *next()
+  {
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    if (head - position > header->capacity)
+    {
+      // lapped by the writer: skip to the oldest record still in the ring
+      lostRecords += head - header->capacity - position;
+      position = head - header->capacity;
+    }
+
+    while (position < head)
+    {
+      current = &records[position & (header->capacity - 1)];
+      expected = 2 * (position + 1);
+      position++;
+      if (current->sequence.load(std::memory_order_acquire) == expected)
+      {
+        return current;
+      }
+      // overwritten since head was read
+      lostRecords++;
+    }
+    return nullptr;
+  }
+
+  /**
+   * Checks that the record returned by next() was not overwritten while it was used. A record
+   * that fails the check is counted as lost and must be discarded.
+   */
+  bool stillValid()
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (current->sequence.load(std::memory_order_relaxed) == expected)
+    {
+      return true;
+    }
+    lostRecords++;
+    return false;
+  }
+
+  uint64_t lost() const { return lostRecords; }
+  uint64_t capacity() const { return header->capacity; }
+
+  /**
+   * Number of published records not read yet.
+   */
+  uint64_t backlog() const
+  {
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    return head > position ? head - position : 0;
+  }
+
+private:
+  const ShmRingHeader *header = nullptr;
+  const ShmRecord *records = nullptr;
+  const ShmRecord *current = nullptr;
+  size_t size = 0;
+  uint64_t position = 0;
+  uint64_t expected = 0;
+  uint64_t lostRecords = 0;
+};
+
+#endif
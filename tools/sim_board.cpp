@@ -0,0 +1,286 @@
+/**
+ * Simulated board: the native firmware on a pseudo terminal.
+ *
+ * Runs the measurement, command, trace and scale code of the firmware against the rig model in
+ * real time (or faster with --speed) and connects the serial monitor of the board to a pty, so
+ * host tools talk to it like to a board on a USB port. The path of the pty is printed on stdout;
+ * --link also makes a symlink to it. A simulated scale on Serial1 weighs the water that passed
+ * the meter; it collects in the bucket, every run is tared by the firmware.
+ *
+ * Commands of the firmware: "trace on|off|stream", "job <seconds> <cycles>", "selftest [seconds]" (the
+ * test pulses are looped back in software), "hist", "sync <token>", "meter ..." (the registry starts
+ * blank with every run); like the firmware it logs the runtime and pulse rate
+ * every second of a gate. The simulator adds "flow <litres per minute>" to set the flow of the rig
+ * and "estop" to press the emergency stop.
+ *
+ * With --fail-rate a run is aborted by a simulated reset at a random time with the given
+ * probability, for testing the retries of the host tools.
+ *
+ * Usage: sim_board [--speed FACTOR] [--seed N] [--k PULSES_PER_LITRE] [--flow LITRES_PER_MINUTE]
+ *                  [--fail-rate PROBABILITY] [--no-scale] [--link PATH]
+ */
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "clock.h"
+#include "commands.h"
+#include "console.h"
+#include "estop.h"
+#include "histogram.h"
+#include "log.h"
+#include "measurement.h"
+#include "meters.h"
+#include "rig_model.h"
+#include "scale.h"
+#include "selftest.h"
+#include "stream.h"
+#include "trace.h"
+
+const double waterDensity = 998.2;          // grams per litre
+const uint64_t scalePeriod = 100000;        // microseconds between two readings
+const uint64_t stepMicros = 1000;           // simulation step
+const uint64_t statsPeriod = 1000000;       // period of the stats task of the firmware
+
+static Rig state;
+static double bucket = 0;                   // litres in the bucket
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+void estopCommand(const char *)
+{
+  estopPress();
+}
+
+void flowCommand(const char *args)
+{
+  double flow = std::atof(args);
+  if (flow <= 0)
+  {
+    logLine("Usage: flow <litres per minute>");
+    return;
+  }
+  state.model.flow = flow;
+  logLine("Flow: " + String(flow, 2) + " l/min");
+}
+
+const Command commands[] = {
+    {"trace", traceCommand},
+    {"job", jobCommand},
+    {"selftest", selfTestCommand},
+    {"hist", histCommand},
+    {"sync", syncCommand, true},
+    {"meter", meterCommand},
+    {"flow", flowCommand},
+    {"estop", estopCommand},
+};
+const uint8_t commandCount = sizeof(commands) / sizeof(commands[0]);
+
+/**
+ * Sends a reading of the bucket to the scale port, unstable while water is running in.
+ */
+static void sendScaleReading(int fd, std::mt19937_64 &random)
+{
+  std::normal_distribution<double> noise(0, 0.02);
+  char line[64];
+  int length = std::snprintf(line, sizeof(line), "%s,GS,%+011.2f g\r\n", state.opening > 0 ? "US" : "ST",
+                             bucket * waterDensity + noise(random));
+  if (write(fd, line, length) != length)
+  {
+    // the firmware reads the socket continuously, a lost reading is replaced by the next one
+  }
+}
+
+/**
+ * Aborts the running measurement like a watchdog reset of the board would.
+ */
+static void simulateReset()
+{
+  measurement.state = MEASUREMENT_IDLE;
+  setValve(false);
+  logLine("Reset: watchdog");
+  logLine("Boot: 0us");
+  metersBegin(2);
+}
+
+static bool parseOption(const char *name, int &i, int argc, char **argv, double &value)
+{
+  if (std::strcmp(argv[i], name) != 0 || i + 1 >= argc)
+  {
+    return false;
+  }
+  value = std::atof(argv[++i]);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  double speed = 1;
+  double seed = 1;
+  double failRate = 0;
+  bool withScale = true;
+  const char *link = nullptr;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--no-scale") == 0)
+    {
+      withScale = false;
+    }
+    else if (std::strcmp(argv[i], "--link") == 0 && i + 1 < argc)
+    {
+      link = argv[++i];
+    }
+    else if (!parseOption("--speed", i, argc, argv, speed) &&
+             !parseOption("--seed", i, argc, argv, seed) &&
+             !parseOption("--k", i, argc, argv, state.model.kFactor) &&
+             !parseOption("--flow", i, argc, argv, state.model.flow) &&
+             !parseOption("--fail-rate", i, argc, argv, failRate))
+    {
+      std::fprintf(stderr, "usage: %s [--speed FACTOR] [--seed N] [--k PULSES_PER_LITRE] [--flow LITRES_PER_MINUTE]\n"
+                           "       [--fail-rate PROBABILITY] [--no-scale] [--link PATH]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+
+  // the serial monitor; nobody may be reading, so output is dropped instead of blocking the board
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+  {
+    std::perror("pty");
+    return 1;
+  }
+  termios settings;
+  tcgetattr(master, &settings);
+  cfmakeraw(&settings);
+  tcsetattr(master, TCSANOW, &settings);
+
+  if (link)
+  {
+    unlink(link);
+    if (symlink(ptsname(master), link) != 0)
+    {
+      std::perror(link);
+      return 1;
+    }
+  }
+  std::printf("%s\n", ptsname(master));
+  std::fflush(stdout);
+
+  // the scale, connected to Serial1
+  int scaleSockets[2] = {-1, -1};
+  if (withScale && socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, scaleSockets) != 0)
+  {
+    std::perror("socketpair");
+    return 1;
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  rig = &state;
+  state.random.seed((uint64_t)seed);
+  state.nextPulseVolume = pulseVolume(state);
+  clockBegin();
+
+  Serial.attach(master);
+  Serial.begin(115200);
+  logLine("Reset: power-on");
+  logLine("Boot: 0us");
+  metersBegin(2);
+  if (withScale)
+  {
+    Serial1.attach(scaleSockets[0]);
+    scaleBegin(Serial1, 9600, false);
+  }
+
+  std::uniform_real_distribution<double> chance(0, 1);
+  std::normal_distribution<double> drift(1, state.model.drift);
+  MeasurementState previous = MEASUREMENT_IDLE;
+  uint64_t resetTime = UINT64_MAX;
+  uint64_t nextScaleReading = 0;
+  uint64_t nextStats = statsPeriod;
+  auto started = std::chrono::steady_clock::now();
+
+  while (!stopRequested)
+  {
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    uint64_t target = (uint64_t)(elapsed * speed * 1e6);
+
+    while (state.now < target)
+    {
+      double passed = state.passedVolume;
+      advance(state, std::min(stepMicros, target - state.now));
+      bucket += state.passedVolume - passed;
+      estopPoll();
+      pollMeasurement();
+      pollSelfTest();
+
+      if (withScale && state.now >= nextScaleReading)
+      {
+        sendScaleReading(scaleSockets[1], state.random);
+        nextScaleReading = state.now + scalePeriod;
+      }
+
+      if (state.now >= nextStats)
+      {
+        logStats();
+        nextStats += statsPeriod;
+      }
+
+      if (previous == MEASUREMENT_IDLE && measurement.state != MEASUREMENT_IDLE &&
+          measurement.state != MEASUREMENT_SELFTEST)
+      {
+        // a new run: new supply pressure, and maybe a reset somewhere in the gate time
+        state.pressure = drift(state.random);
+        uint64_t gate = (uint64_t)measurement.seconds * measurement.cycles * 1000000;
+        resetTime = chance(state.random) < failRate ? state.now + (uint64_t)(chance(state.random) * gate) : UINT64_MAX;
+      }
+      else if (previous != MEASUREMENT_IDLE && measurement.state == MEASUREMENT_IDLE)
+      {
+        resetTime = UINT64_MAX;
+      }
+      if (state.now >= resetTime)
+      {
+        simulateReset();
+        resetTime = UINT64_MAX;
+      }
+      previous = measurement.state;
+    }
+
+    if (withScale)
+    {
+      scalePoll();
+    }
+    commandsPoll();
+    traceFlush();
+    streamFlush();
+    histogramFlush();
+    logFlush();
+    usleep(1000);
+  }
+
+  if (link)
+  {
+    unlink(link);
+  }
+  return 0;
+}
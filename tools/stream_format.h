@@ -0,0 +1,94 @@
+/**
+ * Merged record stream of several boards, as written by capture_daemon.
+ *
+ * One line per decoded device line, tab-separated:
+ *
+ *   host_us  board  channel  type  time  host_time  value  extra  number  line
+ *
+ * host_us is the host time the bytes were read (microseconds since the epoch), type is a name of
+ * deviceRecordNames, time/value/extra/number are the fields of the DeviceRecord (0 when unused)
+ * and line is the text the board sent. host_time is the device time converted to host time by
+ * the clock sync (clock_sync.h), 0 without a device time or before the board was synchronised;
+ * it orders events of different boards on one timeline. Lines starting with '#' are comments.
+ */
+
+#ifndef STREAM_FORMAT_H
+#define STREAM_FORMAT_H
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "device_decoder.h"
+
+const char streamHeader[] = "# flowmeter stream 2: host_us board channel type time host_time value extra number line";
+
+struct StreamRecord
+{
+  uint64_t hostMicros = 0;
+  uint16_t board = 0;
+  uint16_t channel = 0;
+  DeviceRecord record;
+  uint64_t hostTime = 0;
+  std::string line;
+};
+
+/**
+ * Appends a record as one line of the stream.
+ */
+inline void appendStreamRecord(std::string &out, uint64_t hostMicros, uint16_t board, uint16_t channel,
+                               const DeviceRecord &record, uint64_t hostTime, const char *line, size_t length)
+{
+  char fields[192];
+  int size = std::snprintf(fields, sizeof(fields),
+                           "%" PRIu64 "\t%u\t%u\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%g\t", hostMicros,
+                           board, channel, deviceRecordNames[record.type], record.time, hostTime, record.value,
+                           record.extra, record.number);
+  out.append(fields, size);
+  out.append(line, length);
+  out.push_back('\n');
+}
+
+/**
+ * Parses one line of the stream without line ending. Returns false for comments and malformed
+ * lines.
+ */
+inline bool parseStreamRecord(const char *text, StreamRecord &stream)
+{
+  if (text[0] == '#')
+  {
+    return false;
+  }
+
+  char type[16];
+  unsigned board, channel;
+  unsigned long long hostMicros, time, hostTime, value, extra;
+  double number;
+  int consumed = 0;
+  if (std::sscanf(text, "%llu\t%u\t%u\t%15[^\t]\t%llu\t%llu\t%llu\t%llu\t%lf\t%n", &hostMicros, &board, &channel,
+                  type, &time, &hostTime, &value, &extra, &number, &consumed) < 9 || consumed == 0)
+  {
+    return false;
+  }
+
+  stream.hostMicros = hostMicros;
+  stream.board = board;
+  stream.channel = channel;
+  stream.record = DeviceRecord();
+  stream.record.type = deviceRecordType(type);
+  stream.record.time = time;
+  stream.record.value = value;
+  stream.record.extra = extra;
+  stream.record.number = number;
+  stream.hostTime = hostTime;
+  stream.line = text + consumed;
+  if (stream.record.type == DeviceRecord::TRACE_EVENT && stream.line.size() > 1)
+  {
+    stream.record.event = stream.line[1];
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * Follows the shared-memory ring of capture_daemon and prints the records as a stream.
+ *
+ * The records are read in place from the ring and printed in the format of stream_format.h,
+ * optionally only those of one board or of one type. Records the writer overwrote before they
+ * were read are counted and reported on stderr every second; they never hold up the writer.
+ * --delay makes the reader artificially slow, to see the overrun detection at work.
+ *
+ * Usage: stream_tail NAME [--from-oldest] [--board N] [--type TYPE] [--count] [--delay US]
+ */
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "shm_ring.h"
+#include "stream_format.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "usage: %s NAME [--from-oldest] [--board N] [--type TYPE] [--count] [--delay US]\n", argv[0]);
+    return 2;
+  }
+
+  bool fromOldest = false;
+  bool countOnly = false;
+  int board = -1;
+  int type = -1;
+  long delay = 0;
+  for (int i = 2; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--from-oldest") == 0)
+    {
+      fromOldest = true;
+    }
+    else if (std::strcmp(argv[i], "--count") == 0)
+    {
+      countOnly = true;
+    }
+    else if (std::strcmp(argv[i], "--board") == 0 && i + 1 < argc)
+    {
+      board = std::atoi(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--type") == 0 && i + 1 < argc)
+    {
+      type = deviceRecordType(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--delay") == 0 && i + 1 < argc)
+    {
+      delay = std::atol(argv[++i]);
+    }
+    else
+    {
+      std::fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  ShmRingReader reader;
+  std::string error;
+  if (!reader.open(argv[1], fromOldest, error))
+  {
+    std::fprintf(stderr, "%s: %s\n", argv[1], error.c_str());
+    return 1;
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  std::string out;
+  uint64_t records = 0;
+  uint64_t reportedLost = 0;
+  auto lastReport = std::chrono::steady_clock::now();
+
+  while (!stopRequested)
+  {
+    const ShmRecord *record = reader.next();
+    if (!record)
+    {
+      if (!out.empty())
+      {
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+        out.clear();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    else if ((board < 0 || record->board == board) && (type < 0 || record->type == type))
+    {
+      size_t mark = out.size();
+      if (!countOnly)
+      {
+        DeviceRecord decoded;
+        decoded.type = (DeviceRecord::Type)record->type;
+        decoded.event = record->event;
+        decoded.time = record->time;
+        decoded.value = record->value;
+        decoded.extra = record->extra;
+        decoded.number = record->number;
+        appendStreamRecord(out, record->hostMicros, record->board, record->channel, decoded, record->hostTime,
+                           record->line, record->length);
+      }
+
+      if (reader.stillValid())
+      {
+        records++;
+      }
+      else
+      {
+        out.resize(mark);
+      }
+      if (delay > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+      }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastReport >= std::chrono::seconds(1))
+    {
+      lastReport = now;
+      if (reader.lost() != reportedLost)
+      {
+        std::fprintf(stderr, "lost %llu records (overrun)\n", (unsigned long long)(reader.lost() - reportedLost));
+        reportedLost = reader.lost();
+      }
+    }
+  }
+
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  std::fprintf(stderr, "%llu records read, %llu lost\n", (unsigned long long)records, (unsigned long long)reader.lost());
+  return 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * Fixed pool of worker threads for the host tools.
+ *
+ * Work is split into chunks by parallelFor(); a chunk always covers the same range regardless of
+ * the number of threads, so tools that seed a random generator per chunk give the same result on
+ * every machine.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  /**
+   * Starts the workers, one per hardware thread when threads is 0.
+   */
+  explicit ThreadPool(unsigned threads = 0)
+  {
+    if (threads == 0)
+    {
+      threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0)
+    {
+      threads = 1;
+    }
+    for (unsigned i = 0; i < threads; i++)
+    {
+      workers.emplace_back([this] { work(); });
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+    {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return workers.size(); }
+
+  /**
+   * Queues a job for the next free worker.
+   */
+  void submit(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push(std::move(job));
+      pending++;
+    }
+    wake.notify_one();
+  }
+
+  /**
+   * Waits until all submitted jobs have finished.
+   */
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+  }
+
+  /**
+   * Runs body(chunk, begin, end) for consecutive ranges of at most chunkSize items of [0, count)
+   * and waits for all of them.
+   */
+  void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t, size_t)> &body)
+  {
+    for (size_t begin = 0, chunk = 0; begin < count; begin += chunkSize, chunk++)
+    {
+      size_t end = begin + chunkSize < count ? begin + chunkSize : count;
+      submit([&body, chunk, begin, end] { body(chunk, begin, end); });
+    }
+    wait();
+  }
+
+private:
+  void work()
+  {
+    for (;;)
+    {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+        {
+          return;
+        }
+        job = std::move(jobs.front());
+        jobs.pop();
+      }
+
+      job();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending == 0)
+      {
+        done.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  size_t pending = 0;
+  bool stopping = false;
+};
+
+#endif
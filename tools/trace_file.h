@@ -0,0 +1,99 @@
+/**
+ * Trace files of the flowmeter firmware.
+ *
+ * A trace is a text file with one event per line and absolute device times in microseconds:
+ *
+ *   S <micros> <seconds> <cycles>   measurement started
+ *   V <micros> <open>               valve switched
+ *   B <micros> <pin>                button pressed
+ *   P <micros>                      pulse counted
+ *   F <micros>                      measurement finished
+ *   R <micros> <pulses>             result logged by the firmware
+ *
+ * Lines starting with '#' are comments.
+ */
+
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct TraceEvent
+{
+  char type;
+  uint64_t time;
+  uint64_t value;
+  uint64_t extra;
+};
+
+const char traceFileHeader[] = "# flowmeter trace 1";
+
+/**
+ * Writes one event line.
+ */
+inline void writeTraceEvent(FILE *file, const TraceEvent &event)
+{
+  switch (event.type)
+  {
+  case 'S':
+    std::fprintf(file, "S %llu %llu %llu\n", (unsigned long long)event.time, (unsigned long long)event.value,
+                 (unsigned long long)event.extra);
+    break;
+  case 'V':
+  case 'B':
+  case 'R':
+    std::fprintf(file, "%c %llu %llu\n", event.type, (unsigned long long)event.time, (unsigned long long)event.value);
+    break;
+  default:
+    std::fprintf(file, "%c %llu\n", event.type, (unsigned long long)event.time);
+    break;
+  }
+}
+
+/**
+ * Reads all events of a trace file. Returns false if the file cannot be opened or has a
+ * malformed line; events up to that line are kept.
+ */
+inline bool readTrace(const char *path, std::vector<TraceEvent> &events, std::string &error)
+{
+  FILE *file = std::fopen(path, "r");
+  if (!file)
+  {
+    error = std::string("cannot open ") + path;
+    return false;
+  }
+
+  char line[128];
+  int number = 0;
+  while (std::fgets(line, sizeof(line), file))
+  {
+    number++;
+    if (line[0] == '#' || line[0] == '\n')
+    {
+      continue;
+    }
+
+    TraceEvent event = {0, 0, 0, 0};
+    unsigned long long time = 0, value = 0, extra = 0;
+    int fields = std::sscanf(line, "%c %llu %llu %llu", &event.type, &time, &value, &extra);
+    if (fields < 2)
+    {
+      error = std::string(path) + ":" + std::to_string(number) + ": malformed line";
+      std::fclose(file);
+      return false;
+    }
+
+    event.time = time;
+    event.value = value;
+    event.extra = extra;
+    events.push_back(event);
+  }
+
+  std::fclose(file);
+  return true;
+}
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * Records a trace from the serial output of a board.
+ *
+ * Sends "trace on" to the board, turns the trace lines ("Trace: <base>", "T<type> <delta> ...")
+ * into a trace file with absolute times and adds an R event for every "Pulses: N" result. All
+ * other lines are echoed to stdout. Stops with Ctrl-C, after sending "trace off".
+ *
+ * With --stream it sends "trace stream" instead: the board sends the pulses in compressed frames
+ * (about one byte per pulse, see pulse_stream.h), so fast meters can be traced at full resolution
+ * within the bandwidth of the UART. The frames are decoded in any case. As they arrive later than
+ * the lines of other events, the events are held back for one second of device time and written
+ * in time order as they leave that window, so the file grows while the recording runs. The bytes
+ * per pulse of the frames are reported on stderr.
+ *
+ * Usage: trace_record PORT OUTPUT [--baud N] [--stream]
+ *        trace_record - OUTPUT       convert a saved serial log from stdin
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "pulse_stream.h"
+#include "serial_port.h"
+#include "trace_file.h"
+
+// Device time the events are held back for, longer than a frame of the pulse stream is late
+const uint64_t reorderMicros = 1000000;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+/**
+ * Events waiting for the later events of the reorder window, in time order.
+ */
+class EventWindow
+{
+public:
+  explicit EventWindow(FILE *output) : output(output) {}
+
+  void add(const TraceEvent &event)
+  {
+    // after the events of the same time, so lines keep their order
+    auto position = std::upper_bound(events.begin(), events.end(), event,
+                                     [](const TraceEvent &a, const TraceEvent &b) { return a.time < b.time; });
+    events.insert(position, event);
+    newest = std::max(newest, event.time);
+  }
+
+  /**
+   * Writes the events older than the window, or all of them.
+   */
+  void flush(bool all)
+  {
+    size_t count = 0;
+    while (count < events.size() && (all || events[count].time + reorderMicros < newest))
+    {
+      writeTraceEvent(output, events[count++]);
+    }
+    if (count > 0)
+    {
+      events.erase(events.begin(), events.begin() + count);
+      std::fflush(output);
+    }
+  }
+
+  uint64_t latest() const { return newest; }
+
+private:
+  FILE *output;
+  std::vector<TraceEvent> events;
+  uint64_t newest = 0;
+};
+
+/**
+ * Collects the trace events and results of a record, echoes other lines.
+ */
+static void recordLine(EventWindow &window, const DeviceRecord &record, const std::string &line)
+{
+  switch (record.type)
+  {
+  case DeviceRecord::TRACE_EVENT:
+    window.add({record.event, record.time, record.value, record.extra});
+    break;
+
+  case DeviceRecord::PULSES:
+    window.add({'R', window.latest(), record.value, 0});
+    // fall through
+  default:
+    std::printf("%s\n", line.c_str());
+    std::fflush(stdout);
+    break;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    std::fprintf(stderr, "usage: %s PORT|- OUTPUT [--baud N] [--stream]\n", argv[0]);
+    return 2;
+  }
+
+  int baud = 115200;
+  bool streaming = false;
+  for (int i = 3; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+    {
+      baud = std::atoi(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--stream") == 0)
+    {
+      streaming = true;
+    }
+  }
+
+  bool fromStdin = std::strcmp(argv[1], "-") == 0;
+  int fd = fromStdin ? STDIN_FILENO : openSerialPort(argv[1], baud);
+  if (fd < 0)
+  {
+    std::perror(argv[1]);
+    return 1;
+  }
+
+  FILE *output = std::fopen(argv[2], "w");
+  if (!output)
+  {
+    std::perror(argv[2]);
+    return 1;
+  }
+  std::fprintf(output, "%s\n", traceFileHeader);
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  const char *command = streaming ? "trace stream\n" : "trace on\n";
+  if (!fromStdin && write(fd, command, std::strlen(command)) != (ssize_t)std::strlen(command))
+  {
+    std::perror("write");
+  }
+
+  DeviceReader reader;
+  EventWindow window(output);
+  char buffer[512];
+
+  while (!stopRequested)
+  {
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+      break;
+    }
+
+    reader.feed(buffer, length, [&](const DeviceRecord &record, const std::string &line) { recordLine(window, record, line); });
+    window.flush(false);
+  }
+
+  if (!fromStdin && write(fd, "trace off\n", 10) != 10)
+  {
+    std::perror("write");
+  }
+
+  window.flush(true);
+  std::fclose(output);
+
+  const PulseStream &stream = reader.stream;
+  if (stream.frames > 0 || stream.badFrames > 0)
+  {
+    std::fprintf(stderr, "stream: %llu pulses in %llu frames, %.2f bytes per pulse, %llu bad frames\n",
+                 (unsigned long long)stream.pulses, (unsigned long long)stream.frames,
+                 stream.pulses ? (double)stream.frameBytes / stream.pulses : 0.0, (unsigned long long)stream.badFrames);
+  }
+  return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * Replays a recorded trace through the native build of the firmware.
+ *
+ * Every S event starts a measurement and every P event calls countPulse() at its recorded time.
+ * The firmware is polled at the time of every recorded event. That is not the loop timing of the
+ * board, which is not recorded: a gate ends at the first event after its end time, while the
+ * board may have ended it earlier, so pulses close to a gate edge can fall into another gate
+ * than on the board. Valve switches of the replay are compared with the recorded V events and
+ * the pulse totals with the recorded R events.
+ *
+ * Usage: trace_replay TRACE [--verbose]
+ *
+ * Exits with 1 if the replay diverges from the recording.
+ */
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "board.h"
+#include "clock.h"
+#include "measurement.h"
+#include "trace_file.h"
+
+struct ValveSwitch
+{
+  uint64_t time;
+  bool open;
+};
+
+static std::vector<ValveSwitch> valveSwitches;
+
+void setValve(bool open)
+{
+  valveSwitches.push_back({clockMicros(), open});
+}
+
+void writeToDisplay(const String, const int)
+{
+}
+
+/**
+ * Polls the firmware at a given time and remembers the pulse count of a finished measurement.
+ */
+static void pollAt(uint64_t time, std::vector<unsigned long> &results)
+{
+  if (time > clockMicros())
+  {
+    clockSetMicros(time);
+  }
+
+  if (pollMeasurement())
+  {
+    results.push_back(measurement.pulseCount);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "usage: %s TRACE [--verbose]\n", argv[0]);
+    return 2;
+  }
+  if (argc > 2 && std::strcmp(argv[2], "--verbose") == 0)
+  {
+    Serial.attach(1);
+  }
+
+  std::vector<TraceEvent> events;
+  std::string error;
+  if (!readTrace(argv[1], events, error))
+  {
+    std::fprintf(stderr, "%s\n", error.c_str());
+    if (events.empty())
+    {
+      return 1;
+    }
+  }
+
+  clockBegin();
+  if (!events.empty())
+  {
+    clockSetMicros(events.front().time);
+  }
+
+  std::vector<unsigned long> results;
+  std::vector<uint64_t> recorded;
+  size_t recordedValve = 0;
+  uint64_t pulses = 0;
+  int runs = 0;
+  int mismatches = 0;
+
+  for (const TraceEvent &event : events)
+  {
+    pollAt(event.time, results);
+
+    switch (event.type)
+    {
+    case 'S':
+      if (measurement.state != MEASUREMENT_IDLE)
+      {
+        std::printf("%llu: start while a measurement is running\n", (unsigned long long)event.time);
+        mismatches++;
+        break;
+      }
+      startMeasurement(event.value, event.extra);
+      runs++;
+      break;
+
+    case 'P':
+      countPulse();
+      pulses++;
+      break;
+
+    case 'V':
+      if (recordedValve >= valveSwitches.size() || valveSwitches[recordedValve].open != (event.value != 0))
+      {
+        std::printf("%llu: valve %s recorded, replay differs\n", (unsigned long long)event.time,
+                    event.value ? "open" : "close");
+        mismatches++;
+      }
+      else if (valveSwitches[recordedValve].time != event.time)
+      {
+        std::printf("%llu: valve %s replayed at %llu\n", (unsigned long long)event.time, event.value ? "open" : "close",
+                    (unsigned long long)valveSwitches[recordedValve].time);
+      }
+      recordedValve++;
+      break;
+
+    case 'R':
+      // the result line may overtake the queued trace events, so results are compared at the end
+      recorded.push_back(event.value);
+      break;
+    }
+  }
+
+  // a trace cut off during a measurement: let it run to the end
+  while (measurement.state == MEASUREMENT_GATE || measurement.state == MEASUREMENT_PAUSE)
+  {
+    pollAt(measurement.phaseEnd, results);
+  }
+  for (size_t i = 0; i < std::max(results.size(), recorded.size()); i++)
+  {
+    if (i >= results.size())
+    {
+      std::printf("run %zu: recorded %llu pulses, replay did not finish\n", i + 1, (unsigned long long)recorded[i]);
+      mismatches++;
+    }
+    else if (i >= recorded.size())
+    {
+      std::printf("run %zu: replayed %lu pulses, no recorded result\n", i + 1, results[i]);
+    }
+    else
+    {
+      bool match = results[i] == recorded[i];
+      std::printf("run %zu: recorded %llu pulses, replayed %lu pulses%s\n", i + 1, (unsigned long long)recorded[i],
+                  results[i], match ? "" : "  MISMATCH");
+      mismatches += match ? 0 : 1;
+    }
+  }
+
+  double seconds = events.empty() ? 0 : (events.back().time - events.front().time) * 1e-6;
+  std::printf("%d runs, %llu pulses, %.1f s of trace, %d mismatches\n", runs, (unsigned long long)pulses, seconds,
+              mismatches);
+
+  return mismatches > 0 ? 1 : 0;
+}
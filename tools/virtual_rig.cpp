@@ -0,0 +1,237 @@
+/**
+ * Virtual test rig for the native build of the firmware.
+ *
+ * Runs the real measurement code against a physical model of the rig: the valve opens and closes
+ * with a lag and a flow ramp, the supply pressure drifts between runs and pulsates within a run,
+ * the meter turns volume into pulses with a K-factor, per-pulse jitter and spurious glitches, and
+ * loop() passes take a random time. Every profile is run many times and the distribution of the
+ * pulse totals is reported:
+ *
+ *   count error  pulses against the volume that really passed the meter (counting accuracy)
+ *   total error  pulses against nominal flow times nominal gate time (rig and gate timing)
+ *
+ * With --verbose the serial output of the firmware goes to stdout; --trace adds the trace lines,
+ * which trace_record can turn into a trace file.
+ *
+ * Usage: virtual_rig [--runs N] [--profile SECONDS CYCLES]... [--seed N] [--verbose] [--trace]
+ *                    [--k PULSES_PER_LITRE] [--flow LITRES_PER_MINUTE]
+ *                    [--open-lag S] [--close-lag S] [--ramp S]
+ *                    [--ripple RELATIVE] [--ripple-frequency HZ] [--drift RELATIVE]
+ *                    [--pulse-jitter RELATIVE] [--glitch-rate PER_SECOND]
+ *                    [--loop-min S] [--loop-max S]
+ */
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "clock.h"
+#include "histogram.h"
+#include "log.h"
+#include "measurement.h"
+#include "rig_model.h"
+#include "trace.h"
+
+struct Profile
+{
+  unsigned long seconds;
+  unsigned int cycles;
+};
+
+struct RunResult
+{
+  unsigned long pulses;
+  double passedVolume;
+};
+
+/**
+ * Runs one measurement through the firmware until pollMeasurement() reports the end.
+ */
+static RunResult runOnce(Rig &state, const Profile &profile)
+{
+  const RigModel &model = state.model;
+  std::normal_distribution<double> drift(1, model.drift);
+  std::uniform_real_distribution<double> phase(0, 2 * M_PI);
+  std::uniform_real_distribution<double> loopTime(model.loopMin * 1e6, model.loopMax * 1e6);
+
+  state.pressure = drift(state.random);
+  state.ripplePhase = phase(state.random);
+  state.passedVolume = 0;
+
+  if (profile.cycles == 10)
+  {
+    runMessurementSplitted(profile.seconds);
+  }
+  else if (profile.cycles == 1)
+  {
+    runMessurementFull(profile.seconds);
+  }
+  else
+  {
+    startMeasurement(profile.seconds, profile.cycles);
+  }
+
+  // coarse steps while nothing is due, loop() passes near the end of a phase
+  const uint64_t coarseStep = 1000;
+  while (true)
+  {
+    uint64_t step = (uint64_t)loopTime(state.random);
+    if (state.now + coarseStep + step < measurement.phaseEnd)
+    {
+      step = coarseStep;
+    }
+
+    advance(state, step);
+    bool finished = pollMeasurement();
+
+    traceFlush();
+    histogramFlush();
+    logFlush();
+    if (finished)
+    {
+      break;
+    }
+  }
+
+  // let the meter run down before the next run
+  while (state.opening > 0)
+  {
+    advance(state, coarseStep);
+    histogramFlush();
+    logFlush();
+  }
+
+  return {measurement.pulseCount, state.passedVolume};
+}
+
+struct Distribution
+{
+  double mean, deviation, minimum, p1, p50, p99, maximum;
+};
+
+static Distribution distribution(std::vector<double> values)
+{
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+
+  double sum = 0;
+  for (double value : values)
+  {
+    sum += value;
+  }
+  double mean = sum / n;
+
+  double squares = 0;
+  for (double value : values)
+  {
+    squares += (value - mean) * (value - mean);
+  }
+
+  auto percentile = [&](double p) { return values[std::min(n - 1, (size_t)(p * (n - 1) + 0.5))]; };
+  return {mean, n > 1 ? std::sqrt(squares / (n - 1)) : 0, values.front(), percentile(0.01), percentile(0.5), percentile(0.99), values.back()};
+}
+
+static void printDistribution(const char *name, const Distribution &d)
+{
+  std::printf("  %-12s mean %+8.4f%%  sd %7.4f%%  min %+8.4f%%  p1 %+8.4f%%  p50 %+8.4f%%  p99 %+8.4f%%  max %+8.4f%%\n",
+              name, d.mean, d.deviation, d.minimum, d.p1, d.p50, d.p99, d.maximum);
+}
+
+static bool parseOption(const char *name, int &i, int argc, char **argv, double &value)
+{
+  if (std::strcmp(argv[i], name) != 0 || i + 1 >= argc)
+  {
+    return false;
+  }
+  value = std::atof(argv[++i]);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  Rig state;
+  RigModel &model = state.model;
+  std::vector<Profile> profiles;
+  double runs = 1000;
+  double seed = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--profile") == 0 && i + 2 < argc)
+    {
+      profiles.push_back({std::strtoul(argv[i + 1], 0, 10), (unsigned int)std::strtoul(argv[i + 2], 0, 10)});
+      i += 2;
+    }
+    else if (std::strcmp(argv[i], "--verbose") == 0)
+    {
+      Serial.attach(1);
+    }
+    else if (std::strcmp(argv[i], "--trace") == 0)
+    {
+      Serial.attach(1);
+      traceEnable(true);
+    }
+    else if (!parseOption("--runs", i, argc, argv, runs) &&
+             !parseOption("--seed", i, argc, argv, seed) &&
+             !parseOption("--k", i, argc, argv, model.kFactor) &&
+             !parseOption("--flow", i, argc, argv, model.flow) &&
+             !parseOption("--open-lag", i, argc, argv, model.openLag) &&
+             !parseOption("--close-lag", i, argc, argv, model.closeLag) &&
+             !parseOption("--ramp", i, argc, argv, model.ramp) &&
+             !parseOption("--ripple", i, argc, argv, model.ripple) &&
+             !parseOption("--ripple-frequency", i, argc, argv, model.rippleFrequency) &&
+             !parseOption("--drift", i, argc, argv, model.drift) &&
+             !parseOption("--pulse-jitter", i, argc, argv, model.pulseJitter) &&
+             !parseOption("--glitch-rate", i, argc, argv, model.glitchRate) &&
+             !parseOption("--loop-min", i, argc, argv, model.loopMin) &&
+             !parseOption("--loop-max", i, argc, argv, model.loopMax))
+    {
+      std::fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  if (profiles.empty())
+  {
+    // the four buttons of the rig
+    profiles = {{1, 10}, {3, 10}, {10, 1}, {100, 1}};
+  }
+
+  rig = &state;
+  state.random.seed((uint64_t)seed);
+  state.nextPulseVolume = pulseVolume(state);
+  clockBegin();
+
+  std::printf("K-factor %.1f/l, flow %.2f l/min, lag %.0f/%.0f ms, ramp %.0f ms, ripple %.1f%% at %.1f Hz, drift %.1f%%, %d runs per profile\n",
+              model.kFactor, model.flow, model.openLag * 1e3, model.closeLag * 1e3, model.ramp * 1e3,
+              model.ripple * 100, model.rippleFrequency, model.drift * 100, (int)runs);
+  std::fflush(stdout);
+
+  for (const Profile &profile : profiles)
+  {
+    std::vector<double> countErrors;
+    std::vector<double> totalErrors;
+    double nominal = model.kFactor * model.flow / 60 * profile.seconds * profile.cycles;
+
+    for (int run = 0; run < (int)runs; run++)
+    {
+      RunResult result = runOnce(state, profile);
+      double expected = model.kFactor * result.passedVolume;
+
+      countErrors.push_back(expected > 0 ? (result.pulses - expected) / expected * 100 : 0);
+      totalErrors.push_back((result.pulses - nominal) / nominal * 100);
+    }
+
+    std::printf("%lus x %u (nominal %.0f pulses)\n", profile.seconds, profile.cycles, nominal);
+    printDistribution("count error", distribution(countErrors));
+    printDistribution("total error", distribution(totalErrors));
+  }
+
+  return 0;
+}